@@ -200,3 +200,50 @@ pk_str_trim (char **str)
   while (isspace (*--end));
   *(end + 1) = '\0';
 }
+
+int
+pk_str_startswith (const char *str, const char *prefix)
+{
+  return strncmp (str, prefix, strlen (prefix)) == 0;
+}
+
+long
+pk_parse_hex_pattern (const char *str, uint8_t *pattern, uint8_t *mask)
+{
+  long len = 0;
+  int nibble = 0;
+
+  for (; *str != '\0'; ++str)
+    {
+      int digit, digit_mask = 0xf;
+
+      if (isspace ((unsigned char) *str))
+        continue;
+
+      if (*str >= '0' && *str <= '9')
+        digit = *str - '0';
+      else if (*str >= 'a' && *str <= 'f')
+        digit = *str - 'a' + 10;
+      else if (*str >= 'A' && *str <= 'F')
+        digit = *str - 'A' + 10;
+      else if (*str == '?')
+        digit = digit_mask = 0;
+      else
+        return -1;
+
+      if (nibble == 0)
+        {
+          pattern[len] = digit << 4;
+          mask[len] = digit_mask << 4;
+        }
+      else
+        {
+          pattern[len] |= digit;
+          mask[len] |= digit_mask;
+          len++;
+        }
+      nibble = !nibble;
+    }
+
+  return nibble == 0 ? len : -1;
+}
@@ -59,4 +59,16 @@ char *pk_str_replace (const char *in, const char *search, const char *replace);
 /* Left and rigth trim the given string from whitespaces.  */
 void pk_str_trim (char **str);
 
+/* Return 1 if STR starts with PREFIX, 0 otherwise.  */
+int pk_str_startswith (const char *str, const char *prefix);
+
+/* Parse the byte pattern in STR, written as pairs of hexadecimal
+   digits, into PATTERN and MASK, which shall be able to hold
+   strlen (STR) / 2 bytes.  A `?' instead of a digit matches any
+   nibble, and sets the corresponding bits of MASK to zero.  Blank
+   characters are ignored.  Return the number of bytes in the pattern,
+   or -1 if STR is not a valid pattern.  */
+long pk_parse_hex_pattern (const char *str, uint8_t *pattern,
+                           uint8_t *mask);
+
 #endif /* ! PK_UTILS_H */
@@ -23,21 +23,99 @@
 /* We want 64-bit file offsets in all systems.  */
 #define _FILE_OFFSET_BITS 64
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#ifdef HAVE_LINUX_FS_H
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+#endif
+#ifdef HAVE_LIBURING
+# include <liburing.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
 
 #include "ios.h"
 #include "ios-dev.h"
 
+/* File devices access the underlying file using pread and pwrite on
+   a file descriptor.
+
+   Reads smaller than the current read-ahead window are served from a
+   private buffer that holds a window of file contents, aligned to
+   FILE_RA_MIN bytes.  The size of the window starts at FILE_RA_MIN
+   and is doubled every time a sequential access pattern is detected,
+   up to FILE_RA_MAX bytes.  Non-sequential reads reset it to
+   FILE_RA_MIN.
+
+   Block devices report a size of zero, so their size is obtained
+   with the BLKGETSIZE64 ioctl, or by seeking to their end.
+
+   If IOS_F_DIRECT is specified, the file is opened with O_DIRECT so
+   the data doesn't go through the page cache of the system.  This
+   requires the offset, size and memory address of every transfer to
+   be aligned to the logical block size of the underlying device, so
+   all the transfers are done through the window, which is then
+   aligned to that size as well.  Writes read and write back the
+   affected blocks.
+
+   Batches of reads are submitted at once to an io_uring when poke is
+   built with liburing, so the kernel can serve them concurrently.
+   The ring is set up the first time a batch is read.  If the ring
+   can't be set up, as it happens in kernels without io_uring, and
+   for files opened with O_DIRECT, the reads in the batch are served
+   one after the other.  */
+
+#define FILE_RA_MIN 4096
+#define FILE_RA_MAX (256 * 1024)
+
+/* Number of entries in the io_uring of a file device, which is the
+   maximum number of reads in flight.  */
+
+#define FILE_RING_DEPTH 64
+
 /* State associated with a file device.  */
 
 struct ios_dev_file
 {
-  FILE *file;
+  int fd;
   char *filename;
   uint64_t flags;
+
+  /* Size of the file in bytes.  This is obtained with fstat when the
+     file is opened, and updated when writes extend the file.  */
+  ios_dev_off size;
+
+  /* Whether the file is a regular file.  */
+  int regular_p;
+
+  /* Alignment required for the transfers, which is 1 unless the file
+     is accessed with O_DIRECT.  RA_ALIGN is the alignment of the
+     window, which is a multiple of ALIGN.  */
+  size_t align;
+  size_t ra_align;
+
+  /* Read-ahead window.  RA_BUF contains RA_LEN bytes read from the
+     file starting at RA_OFF.  RA_SIZE is the current size of the
+     window.  RA_NEXT is the offset right after the last byte
+     requested by the previous read, which is used in order to detect
+     sequential accesses.  */
+  uint8_t *ra_buf;
+  ios_dev_off ra_off;
+  size_t ra_len;
+  size_t ra_size;
+  ios_dev_off ra_next;
+
+#ifdef HAVE_LIBURING
+  /* The io_uring used to read batches.  RING_STATE is 0 if the ring
+     has not been set up yet, 1 if it has, and -1 if it couldn't.  */
+  struct io_uring ring;
+  int ring_state;
+#endif
 };
 
 static char *
@@ -50,25 +128,87 @@ ios_dev_file_handler_normalize (const char *handler, uint64_t flags)
   return newhandler;
 }
 
+/* Open HANDLER with the open flags OFLAGS, adding O_DIRECT if
+   IOS_F_DIRECT is in *FLAGS.  If O_DIRECT is not supported, open the
+   file without it and clear IOS_F_DIRECT in *FLAGS.  Return the file
+   descriptor, or -1 on error.  */
+
+static int
+ios_dev_file_open_fd (const char *handler, int oflags, uint64_t *flags)
+{
+#ifdef O_DIRECT
+  if (*flags & IOS_F_DIRECT)
+    {
+      int fd = open (handler, oflags | O_DIRECT, 0666);
+
+      if (fd != -1 || errno != EINVAL)
+        return fd;
+    }
+#endif
+
+  *flags &= ~IOS_F_DIRECT;
+  return open (handler, oflags, 0666);
+}
+
+/* Return the size in bytes of the block device FD.  */
+
+static ios_dev_off
+ios_dev_file_blkdev_size (int fd)
+{
+  off_t end;
+
+#ifdef BLKGETSIZE64
+  uint64_t size;
+
+  if (ioctl (fd, BLKGETSIZE64, &size) == 0)
+    return size;
+#endif
+
+  end = lseek (fd, 0, SEEK_END);
+  return end > 0 ? end : 0;
+}
+
+/* Return the alignment required by O_DIRECT transfers on the file FD,
+   whose status is ST.  */
+
+static size_t
+ios_dev_file_direct_align (int fd, struct stat *st)
+{
+#ifdef BLKSSZGET
+  int size;
+
+  if (S_ISBLK (st->st_mode)
+      && ioctl (fd, BLKSSZGET, &size) == 0 && size > 0)
+    return size;
+#endif
+
+  /* This is a multiple of the logical block size of the usual
+     devices.  */
+  return 4096;
+}
+
 static void *
 ios_dev_file_open (const char *handler, uint64_t flags, int *error)
 {
   struct ios_dev_file *fio = NULL;
-  FILE *f;
-  const char *mode;
+  struct stat st;
+  int fd;
   uint8_t flags_mode = flags & IOS_FLAGS_MODE;
 
   if (flags_mode != 0)
     {
+      int oflags;
+
       /* Decide what mode to use to open the file.  */
       if (flags_mode == IOS_F_READ)
-        mode = "rb";
+        oflags = O_RDONLY;
       else if (flags_mode == (IOS_F_WRITE | IOS_F_CREATE | IOS_F_TRUNCATE))
-        mode = "wb";
+        oflags = O_WRONLY | O_CREAT | O_TRUNC;
       else if (flags_mode == (IOS_F_READ | IOS_F_WRITE))
-        mode = "r+b";
-      else if (flags_mode == (IOS_F_WRITE | IOS_F_CREATE | IOS_F_TRUNCATE))
-        mode = "w+b";
+        oflags = O_RDWR;
+      else if (flags_mode == (IOS_F_READ | IOS_F_WRITE
+                              | IOS_F_CREATE | IOS_F_TRUNCATE))
+        oflags = O_RDWR | O_CREAT | O_TRUNC;
       else
         {
           /* Invalid mode.  */
@@ -77,46 +217,84 @@ ios_dev_file_open (const char *handler, uint64_t flags, int *error)
           return NULL;
         }
 
-      f = fopen (handler, mode);
+      fd = ios_dev_file_open_fd (handler, oflags, &flags);
     }
   else
     {
       /* Try read-write initially.
          If that fails, then try read-only. */
-      f = fopen (handler, "r+b");
+      fd = ios_dev_file_open_fd (handler, O_RDWR, &flags);
       flags |= (IOS_F_READ | IOS_F_WRITE);
-      if (!f)
+      if (fd == -1)
         {
-          f = fopen (handler, "rb");
+          fd = ios_dev_file_open_fd (handler, O_RDONLY, &flags);
           flags &= ~IOS_F_WRITE;
         }
     }
 
-  if (!f)
+  if (fd == -1 || fstat (fd, &st) == -1)
     goto err;
 
   fio = malloc (sizeof (struct ios_dev_file));
   if (!fio)
     goto err;
 
+  fio->ra_buf = NULL;
   fio->filename = strdup (handler);
   if (!fio->filename)
     goto err;
 
-  fio->file = f;
+  fio->align = 1;
+  if (flags & IOS_F_DIRECT)
+    fio->align = ios_dev_file_direct_align (fd, &st);
+  fio->ra_align = fio->align > FILE_RA_MIN ? fio->align : FILE_RA_MIN;
+
+  /* The window may need to include up to RA_ALIGN - 1 bytes before
+     the requested data, due to alignment.  */
+  if (fio->align > 1)
+    {
+      void *ra_buf;
+
+      if (posix_memalign (&ra_buf, fio->align,
+                          FILE_RA_MAX + fio->ra_align) != 0)
+        goto err;
+      fio->ra_buf = ra_buf;
+    }
+  else
+    {
+      fio->ra_buf = malloc (FILE_RA_MAX + fio->ra_align);
+      if (!fio->ra_buf)
+        goto err;
+    }
+
+  fio->fd = fd;
   fio->flags = flags;
+  fio->regular_p = S_ISREG (st.st_mode);
+  /* Devices and other special files report a size of zero.  */
+  if (S_ISBLK (st.st_mode))
+    fio->size = ios_dev_file_blkdev_size (fd);
+  else
+    fio->size = st.st_size > 0 ? st.st_size : 0;
+  fio->ra_off = 0;
+  fio->ra_len = 0;
+  fio->ra_size = FILE_RA_MIN;
+  fio->ra_next = 0;
+#ifdef HAVE_LIBURING
+  fio->ring_state = 0;
+#endif
 
   return fio;
 
 err:
   if (fio)
     {
+      free (fio->ra_buf);
       free (fio->filename);
       free (fio);
     }
 
-  if (f)
-    fclose (f);
+  if (fd != -1)
+    close (fd);
 
   if (error != NULL)
     *error = IOD_ERROR;
@@ -129,8 +307,13 @@ ios_dev_file_close (void *iod)
 {
   struct ios_dev_file *fio = iod;
 
-  if (fclose (fio->file) != 0)
+#ifdef HAVE_LIBURING
+  if (fio->ring_state == 1)
+    io_uring_queue_exit (&fio->ring);
+#endif
+  if (close (fio->fd) != 0)
     perror (fio->filename);
+  free (fio->ra_buf);
   free (fio->filename);
   free (fio);
 
@@ -145,24 +328,340 @@ ios_dev_file_get_flags (void *iod)
   return fio->flags;
 }
 
+/* Read COUNT bytes from the file into BUF, starting at the byte
+   OFFSET.  pread may return less bytes than requested, for example
+   if interrupted by a signal, so keep trying until either all the
+   bytes are read or the end of file is reached.  Return the number
+   of bytes read, or -1 on error.
+
+   With O_DIRECT, a read that ends at an unaligned offset has reached
+   the end of the file, and can't be continued anyway.  */
+
+static ssize_t
+ios_dev_file_pread_full (struct ios_dev_file *fio, void *buf, size_t count,
+                         ios_dev_off offset)
+{
+  uint8_t *p = buf;
+  size_t done = 0;
+
+  while (done < count)
+    {
+      ssize_t ret = pread (fio->fd, p + done, count - done, offset + done);
+
+      if (ret == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
+      if (ret == 0)
+        break;
+
+      done += ret;
+      if (done % fio->align != 0)
+        break;
+    }
+
+  return done;
+}
 
 static int
 ios_dev_file_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_file *fio = iod;
-  size_t ret;
+  ios_dev_off woff;
+  size_t wlen;
+  ssize_t ret;
+
+  /* Adapt the size of the read-ahead window to the access
+     pattern.  */
+  if (offset == fio->ra_next)
+    {
+      if (fio->ra_size < FILE_RA_MAX)
+        fio->ra_size *= 2;
+    }
+  else
+    fio->ra_size = FILE_RA_MIN;
+  fio->ra_next = offset + count;
+
+  /* Serve the request from the window if possible.  */
+  if (offset >= fio->ra_off
+      && offset + count <= fio->ra_off + fio->ra_len)
+    {
+      memcpy (buf, fio->ra_buf + (offset - fio->ra_off), count);
+      return 0;
+    }
+
+  /* Big reads go directly to the file, unless the buffer is not
+     suitable for O_DIRECT.  */
+  if (count >= fio->ra_size && fio->align == 1)
+    {
+      ret = ios_dev_file_pread_full (fio, buf, count, offset);
+      if (ret == -1)
+        return IOD_ERROR;
+      return (size_t) ret == count ? 0 : IOD_EOF;
+    }
+
+  /* Otherwise fill the window and copy from it, as many times as
+     needed.  Note that reading past the end of the file is not an
+     error at this point.  */
+  while (count > 0)
+    {
+      size_t n;
+
+      woff = offset - offset % fio->ra_align;
+      wlen = (offset - woff) + (count > fio->ra_size ? count : fio->ra_size);
+      wlen = (wlen + fio->align - 1) / fio->align * fio->align;
+      if (wlen > FILE_RA_MAX + fio->ra_align)
+        wlen = FILE_RA_MAX + fio->ra_align;
+
+      fio->ra_len = 0;
+      ret = ios_dev_file_pread_full (fio, fio->ra_buf, wlen, woff);
+      if (ret == -1)
+        return IOD_ERROR;
+
+      fio->ra_off = woff;
+      fio->ra_len = ret;
+
+      if (offset + count > woff + ret && (size_t) ret < wlen)
+        return IOD_EOF;
+
+      n = woff + ret - offset;
+      if (n > count)
+        n = count;
+      memcpy (buf, fio->ra_buf + (offset - woff), n);
+      buf = (uint8_t *) buf + n;
+      offset += n;
+      count -= n;
+    }
+
+  return 0;
+}
+
+#ifdef HAVE_LIBURING
+
+/* Perform the NREQS reads in REQS, at most FILE_RING_DEPTH, using the
+   io_uring of FIO.  Return 0 on success.  If the ring fails, tear it
+   down and return IOD_ERROR, so the reads are performed in some other
+   way.  */
+
+static int
+ios_dev_file_pread_ring (struct ios_dev_file *fio,
+                         struct ios_dev_req *reqs, size_t nreqs)
+{
+  size_t i, submitted = 0, done = 0;
+  int ret;
+
+  for (i = 0; i < nreqs; ++i)
+    {
+      struct io_uring_sqe *sqe = io_uring_get_sqe (&fio->ring);
+
+      io_uring_prep_read (sqe, fio->fd, reqs[i].buf, reqs[i].count,
+                          reqs[i].offset);
+      io_uring_sqe_set_data (sqe, &reqs[i]);
+    }
+
+  while (submitted < nreqs)
+    {
+      ret = io_uring_submit (&fio->ring);
+      if (ret == -EINTR)
+        continue;
+      if (ret <= 0)
+        break;
+      submitted += ret;
+    }
+
+  while (done < submitted)
+    {
+      struct io_uring_cqe *cqe;
+      struct ios_dev_req *req;
+      ssize_t n;
+
+      ret = io_uring_wait_cqe (&fio->ring, &cqe);
+      if (ret == -EINTR)
+        continue;
+      if (ret != 0)
+        break;
+
+      req = io_uring_cqe_get_data (cqe);
+      n = cqe->res;
+      io_uring_cqe_seen (&fio->ring, cqe);
+      done++;
+
+      /* Complete short and failed reads synchronously.  */
+      if (n < 0)
+        n = 0;
+      if ((size_t) n < req->count)
+        {
+          ssize_t rest = ios_dev_file_pread_full (fio,
+                                                  (uint8_t *) req->buf + n,
+                                                  req->count - n,
+                                                  req->offset + n);
+          if (rest == -1)
+            {
+              req->ret = IOD_ERROR;
+              continue;
+            }
+          n += rest;
+        }
+
+      req->ret = (size_t) n == req->count ? 0 : IOD_EOF;
+    }
+
+  if (done < nreqs)
+    {
+      io_uring_queue_exit (&fio->ring);
+      fio->ring_state = -1;
+      return IOD_ERROR;
+    }
+
+  return 0;
+}
+
+#endif /* HAVE_LIBURING */
+
+static void
+ios_dev_file_pread_batch (void *iod, struct ios_dev_req *reqs, size_t nreqs)
+{
+  struct ios_dev_file *fio = iod;
+  size_t i;
+
+#ifdef HAVE_LIBURING
+  /* The buffers are not suitable for O_DIRECT.  */
+  if (fio->ring_state == 0 && fio->align == 1)
+    fio->ring_state = (io_uring_queue_init (FILE_RING_DEPTH, &fio->ring, 0)
+                       == 0 ? 1 : -1);
+
+  if (fio->ring_state == 1)
+    {
+      while (nreqs > 0)
+        {
+          size_t n = nreqs > FILE_RING_DEPTH ? FILE_RING_DEPTH : nreqs;
+
+          if (ios_dev_file_pread_ring (fio, reqs, n) != 0)
+            break;
+          reqs += n;
+          nreqs -= n;
+        }
+    }
+#endif
+
+  for (i = 0; i < nreqs; ++i)
+    reqs[i].ret = ios_dev_file_pread (fio, reqs[i].buf, reqs[i].count,
+                                      reqs[i].offset);
+}
+
+/* Write COUNT bytes from BUF to the file, starting at the byte
+   OFFSET, retrying short writes.  Return the number of bytes written.
+   If it is less than COUNT, set *ERR to the error that stopped the
+   writing.  */
+
+static size_t
+ios_dev_file_pwrite_full (struct ios_dev_file *fio, const void *buf,
+                          size_t count, ios_dev_off offset, int *err)
+{
+  const uint8_t *p = buf;
+  size_t done = 0;
+
+  while (done < count)
+    {
+      ssize_t ret = pwrite (fio->fd, p + done, count - done, offset + done);
+
+      if (ret == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          *err = errno;
+          break;
+        }
+      if (ret == 0)
+        {
+          *err = ENOSPC;
+          break;
+        }
+
+      done += ret;
+    }
 
-  /* We are using FILE* for buffering, rather than low-level fd, so we
-     have to fake low-level pread by using fseeko.  */
-  if (fseeko (fio->file, offset, SEEK_SET) == -1)
+  return done;
+}
+
+/* Read the block of the file starting at the byte OFFSET into BUF,
+   filling with zeros whatever is past the end of the file.  Return 0
+   on success, IOD_ERROR otherwise.  */
+
+static int
+ios_dev_file_read_block (struct ios_dev_file *fio, uint8_t *buf,
+                         ios_dev_off offset)
+{
+  ssize_t ret = ios_dev_file_pread_full (fio, buf, fio->align, offset);
+
+  if (ret == -1)
+    return IOD_ERROR;
+  memset (buf + ret, 0, fio->align - ret);
+  return 0;
+}
+
+/* Write COUNT bytes from BUF to a file opened with O_DIRECT, starting
+   at the byte OFFSET.  The affected blocks are assembled in the
+   window, reading first the blocks that are only partially written,
+   and then written back.  */
+
+static int
+ios_dev_file_pwrite_direct (struct ios_dev_file *fio, const void *buf,
+                            size_t count, ios_dev_off offset)
+{
+  const uint8_t *p = buf;
+  ios_dev_off end = offset + count;
+  ios_dev_off written_end = 0;
+
+  /* Devices can't grow.  */
+  if (!fio->regular_p && end > fio->size)
     return IOD_EOF;
-  ret = fread (buf, 1, count, fio->file);
 
-  /* XXX As long as count <= 9 because the ios layer reads at most an
-     unaligned uint64_t, we are unlikely to hit short reads.  But if
-     future code adds in large buffer reads, we may want to retry on
-     short reads rather than giving up right away. */
-  return ret == count ? 0 : IOD_EOF;
+  fio->ra_len = 0;
+  while (count > 0)
+    {
+      ios_dev_off boff = offset - offset % fio->align;
+      size_t start = offset - boff;
+      size_t n = FILE_RA_MAX - start;
+      size_t blen;
+      int err = 0;
+
+      if (n > count)
+        n = count;
+      blen = (start + n + fio->align - 1) / fio->align * fio->align;
+
+      if (start != 0
+          && ios_dev_file_read_block (fio, fio->ra_buf, boff) != 0)
+        return IOD_ERROR;
+      if ((start + n) % fio->align != 0
+          && (start == 0 || blen > fio->align)
+          && ios_dev_file_read_block (fio,
+                                      fio->ra_buf + blen - fio->align,
+                                      boff + blen - fio->align) != 0)
+        return IOD_ERROR;
+
+      memcpy (fio->ra_buf + start, p, n);
+      if (ios_dev_file_pwrite_full (fio, fio->ra_buf, blen, boff, &err)
+          != blen)
+        return err == ENOSPC || err == EFBIG ? IOD_EOF : IOD_ERROR;
+
+      p += n;
+      offset += n;
+      count -= n;
+      written_end = boff + blen;
+    }
+
+  /* Writing whole blocks may have extended the file past the written
+     data.  */
+  if (end > fio->size)
+    fio->size = end;
+  if (fio->regular_p && written_end > fio->size
+      && ftruncate (fio->fd, fio->size) != 0)
+    return IOD_ERROR;
+
+  return 0;
 }
 
 static int
@@ -170,25 +669,110 @@ ios_dev_file_pwrite (void *iod, const void *buf, size_t count,
                      ios_dev_off offset)
 {
   struct ios_dev_file *fio = iod;
-  size_t ret;
+  const uint8_t *p = buf;
+  size_t done;
+  int err = 0;
 
-  /* We are using FILE* for buffering, rather than low-level fd, so we
-     have to fake low-level pread by using fseeko.  */
-  if (fseeko (fio->file, offset, SEEK_SET))
-    return IOD_EOF;
-  ret = fwrite (buf, 1, count, fio->file);
+  if (fio->align > 1)
+    return ios_dev_file_pwrite_direct (fio, buf, count, offset);
+
+  done = ios_dev_file_pwrite_full (fio, buf, count, offset, &err);
+
+  /* Keep the read-ahead window in sync with the contents of the
+     file.  */
+  if (done > 0
+      && offset < fio->ra_off + fio->ra_len
+      && offset + done > fio->ra_off)
+    {
+      ios_dev_off beg = offset > fio->ra_off ? offset : fio->ra_off;
+      ios_dev_off end = offset + done;
 
-  return ret == count ? 0 : IOD_EOF;
+      if (end > fio->ra_off + fio->ra_len)
+        end = fio->ra_off + fio->ra_len;
+      memcpy (fio->ra_buf + (beg - fio->ra_off), p + (beg - offset),
+              end - beg);
+    }
+
+  if (offset + done > fio->size)
+    {
+      /* The window may have been filled with a short read that no
+         longer reflects the end of the file.  */
+      fio->size = offset + done;
+      fio->ra_len = 0;
+    }
+
+  if (done < count)
+    return err == ENOSPC || err == EFBIG ? IOD_EOF : IOD_ERROR;
+
+  return 0;
+}
+
+size_t
+ios_dev_file_copy (void *from_iod, ios_dev_off from,
+                   void *to_iod, ios_dev_off to, size_t count)
+{
+  struct ios_dev_file *ffio = from_iod;
+  struct ios_dev_file *tfio = to_iod;
+  size_t done = 0;
+
+  /* Transfers with O_DIRECT have alignment requirements, and reads
+     past the end of the source are to be reported by the caller.  */
+  if (ffio->align > 1 || tfio->align > 1
+      || from > ffio->size || count > ffio->size - from)
+    return 0;
+
+#ifdef HAVE_COPY_FILE_RANGE
+  while (done < count)
+    {
+      loff_t off_in = from + done;
+      loff_t off_out = to + done;
+      ssize_t ret = copy_file_range (ffio->fd, &off_in, tfio->fd, &off_out,
+                                     count - done, 0);
+
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        break;
+      done += ret;
+    }
+#endif
+
+#if defined HAVE_SENDFILE && defined HAVE_SYS_SENDFILE_H
+  /* sendfile writes at the current position of the output file.  */
+  while (done < count)
+    {
+      off_t off_in = from + done;
+      ssize_t ret;
+
+      if (lseek (tfio->fd, to + done, SEEK_SET) == -1)
+        break;
+      ret = sendfile (tfio->fd, ffio->fd, &off_in, count - done);
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        break;
+      done += ret;
+    }
+#endif
+
+  if (done > 0)
+    {
+      /* The read-ahead window may no longer reflect the contents of
+         the file.  */
+      tfio->ra_len = 0;
+      if (to + done > tfio->size)
+        tfio->size = to + done;
+    }
+
+  return done;
 }
 
 static ios_dev_off
 ios_dev_file_size (void *iod)
 {
-  struct stat st;
   struct ios_dev_file *fio = iod;
 
-  fstat (fileno (fio->file), &st);
-  return st.st_size;
+  return fio->size;
 }
 
 static int
@@ -205,6 +789,7 @@ struct ios_dev_if ios_dev_file
    .close = ios_dev_file_close,
    .pread = ios_dev_file_pread,
    .pwrite = ios_dev_file_pwrite,
+   .pread_batch = ios_dev_file_pread_batch,
    .get_flags = ios_dev_file_get_flags,
    .size = ios_dev_file_size,
    .flush = ios_dev_file_flush
@@ -24,16 +24,149 @@
 #include "ios.h"
 #include "ios-dev.h"
 
-/* State asociated with a memory device.  */
+/* Memory devices are organized as a set of fixed-size chunks of
+   MEM_CHUNK_SIZE bytes.  Chunks are allocated the first time some
+   byte in them is written to, and are kept in a hash table indexed by
+   chunk number.  Chunks that have never been written are not in the
+   table and read as zeros.  This way the memory used by a device is
+   proportional to the data written to it, regardless of the offsets
+   where it is written.
+
+   The size of the device is always a multiple of MEM_CHUNK_SIZE, and
+   grows as needed to cover the highest chunk ever written.  The hash
+   table grows geometrically along with the number of chunks.  */
+
+#define MEM_CHUNK_SIZE (512 * 8)
+#define MEM_MIN_NBUCKETS 16
+
+/* A chunk of a memory device.  INDEX is the chunk number, i.e. the
+   offset of its first byte divided by MEM_CHUNK_SIZE.  */
+
+struct ios_dev_mem_chunk
+{
+  ios_dev_off index;
+  struct ios_dev_mem_chunk *next;
+  char data[MEM_CHUNK_SIZE];
+};
+
+/* State asociated with a memory device.  BUCKETS is a hash table of
+   NBUCKETS chains of chunks, NBUCKETS being a power of two.  LAST is
+   the most recently accessed chunk.  */
 
 struct ios_dev_mem
 {
-  char *pointer;
-  size_t size;
+  struct ios_dev_mem_chunk **buckets;
+  size_t nbuckets;
+  size_t nchunks;
+  struct ios_dev_mem_chunk *last;
+  ios_dev_off size;
   uint64_t flags;
 };
 
-#define MEM_STEP (512 * 8)
+/* Return the bucket for the chunk with the given INDEX in a hash
+   table of NBUCKETS buckets.  Chunk numbers are scrambled, so chunks
+   written at regular strides don't end up in the same bucket.  */
+
+static inline size_t
+ios_dev_mem_hash (ios_dev_off index, size_t nbuckets)
+{
+  return ((index * UINT64_C (0x9e3779b97f4a7c15)) >> 32) & (nbuckets - 1);
+}
+
+static inline struct ios_dev_mem_chunk **
+ios_dev_mem_bucket (struct ios_dev_mem *mio, ios_dev_off index)
+{
+  return &mio->buckets[ios_dev_mem_hash (index, mio->nbuckets)];
+}
+
+/* Return the chunk of MIO with the given INDEX, or NULL if it has
+   never been written.  */
+
+static struct ios_dev_mem_chunk *
+ios_dev_mem_lookup (struct ios_dev_mem *mio, ios_dev_off index)
+{
+  struct ios_dev_mem_chunk *chunk;
+
+  /* Accesses tend to be local, so check the last chunk first.  */
+  if (mio->last && mio->last->index == index)
+    return mio->last;
+
+  if (mio->nbuckets == 0)
+    return NULL;
+
+  for (chunk = *ios_dev_mem_bucket (mio, index); chunk; chunk = chunk->next)
+    if (chunk->index == index)
+      {
+        mio->last = chunk;
+        break;
+      }
+
+  return chunk;
+}
+
+/* Double the number of buckets of the hash table of MIO, or allocate
+   it if it doesn't exist yet.  Return 0 on success, IOD_ERROR
+   otherwise.  */
+
+static int
+ios_dev_mem_grow_table (struct ios_dev_mem *mio)
+{
+  size_t i, nbuckets = (mio->nbuckets == 0
+                        ? MEM_MIN_NBUCKETS : mio->nbuckets * 2);
+  struct ios_dev_mem_chunk **buckets;
+
+  buckets = calloc (nbuckets, sizeof (struct ios_dev_mem_chunk *));
+  if (!buckets)
+    return IOD_ERROR;
+
+  for (i = 0; i < mio->nbuckets; ++i)
+    {
+      struct ios_dev_mem_chunk *chunk, *next;
+
+      for (chunk = mio->buckets[i]; chunk; chunk = next)
+        {
+          size_t b = ios_dev_mem_hash (chunk->index, nbuckets);
+
+          next = chunk->next;
+          chunk->next = buckets[b];
+          buckets[b] = chunk;
+        }
+    }
+
+  free (mio->buckets);
+  mio->buckets = buckets;
+  mio->nbuckets = nbuckets;
+  return 0;
+}
+
+/* Return the chunk of MIO with the given INDEX, allocating it if
+   needed, or NULL if there is not enough memory.  */
+
+static struct ios_dev_mem_chunk *
+ios_dev_mem_get (struct ios_dev_mem *mio, ios_dev_off index)
+{
+  struct ios_dev_mem_chunk *chunk, **bucket;
+
+  if ((chunk = ios_dev_mem_lookup (mio, index)) != NULL)
+    return chunk;
+
+  if (mio->nchunks >= mio->nbuckets
+      && ios_dev_mem_grow_table (mio) != 0)
+    return NULL;
+
+  chunk = calloc (1, sizeof (struct ios_dev_mem_chunk));
+  if (!chunk)
+    return NULL;
+
+  bucket = ios_dev_mem_bucket (mio, index);
+  chunk->index = index;
+  chunk->next = *bucket;
+  *bucket = chunk;
+  mio->nchunks++;
+  mio->last = chunk;
+
+  return chunk;
+}
 
 static char *
 ios_dev_mem_handler_normalize (const char *handler, uint64_t flags)
@@ -51,14 +184,11 @@ ios_dev_mem_open (const char *handler, uint64_t flags, int *error)
   if (!mio)
     return NULL;
 
-  mio->pointer = calloc (MEM_STEP, 1);
-  if (!mio->pointer)
-    {
-      free (mio);
-      return NULL;
-    }
-
-  mio->size = MEM_STEP;
+  mio->buckets = NULL;
+  mio->nbuckets = 0;
+  mio->nchunks = 0;
+  mio->last = NULL;
+  mio->size = MEM_CHUNK_SIZE;
   mio->flags = flags;
 
   return mio;
@@ -68,8 +198,19 @@ static int
 ios_dev_mem_close (void *iod)
 {
   struct ios_dev_mem *mio = iod;
+  size_t i;
+
+  for (i = 0; i < mio->nbuckets; ++i)
+    {
+      struct ios_dev_mem_chunk *chunk, *next;
 
-  free (mio->pointer);
+      for (chunk = mio->buckets[i]; chunk; chunk = next)
+        {
+          next = chunk->next;
+          free (chunk);
+        }
+    }
+  free (mio->buckets);
   free (mio);
 
   return 1;
@@ -87,11 +228,31 @@ static int
 ios_dev_mem_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_mem *mio = iod;
+  char *p = buf;
 
-  if (offset + count > mio->size)
+  if (offset > mio->size || count > mio->size - offset)
     return IOD_EOF;
 
-  memcpy (buf, &mio->pointer[offset], count);
+  while (count > 0)
+    {
+      struct ios_dev_mem_chunk *chunk
+        = ios_dev_mem_lookup (mio, offset / MEM_CHUNK_SIZE);
+      size_t coff = offset % MEM_CHUNK_SIZE;
+      size_t n = MEM_CHUNK_SIZE - coff;
+
+      if (n > count)
+        n = count;
+
+      if (chunk != NULL)
+        memcpy (p, chunk->data + coff, n);
+      else
+        memset (p, 0, n);
+
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
   return 0;
 }
 
@@ -101,27 +262,45 @@ ios_dev_mem_pwrite (void *iod, const void *buf, size_t count,
 
 {
   struct ios_dev_mem *mio = iod;
+  const char *p = buf;
+  ios_dev_off first, last, chunk, end;
+
+  if (count == 0)
+    return 0;
 
-  if (offset + count > mio->size + MEM_STEP)
+  if (count > (ios_dev_off) -1 - offset)
     return IOD_EOF;
+  end = offset + count;
+  if ((end - 1) / MEM_CHUNK_SIZE >= (ios_dev_off) -1 / MEM_CHUNK_SIZE)
+    return IOD_EOF;
+
+  first = offset / MEM_CHUNK_SIZE;
+  last = (end - 1) / MEM_CHUNK_SIZE;
 
-  if (offset + count > mio->size)
+  /* Allocate all the chunks first, so a failed write doesn't modify
+     the contents of the device.  */
+  for (chunk = first; chunk <= last; ++chunk)
+    if (ios_dev_mem_get (mio, chunk) == NULL)
+      return IOD_ERROR;
+
+  while (count > 0)
     {
-      void *pointer_bak = mio->pointer;
+      size_t coff = offset % MEM_CHUNK_SIZE;
+      size_t n = MEM_CHUNK_SIZE - coff;
 
-      mio->pointer = realloc (mio->pointer, mio->size + MEM_STEP);
-      if (!mio->pointer)
-        {
-          /* Restore pointer after failed realloc and return error. */
-          mio->pointer = pointer_bak;
-          return IOD_ERROR;
-        }
+      if (n > count)
+        n = count;
 
-      memset (&mio->pointer[mio->size], 0, MEM_STEP);
-      mio->size += MEM_STEP;
+      memcpy (ios_dev_mem_lookup (mio, offset / MEM_CHUNK_SIZE)->data + coff,
+              p, n);
+      p += n;
+      offset += n;
+      count -= n;
     }
 
-  memcpy (&mio->pointer[offset], buf, count);
+  if ((last + 1) * MEM_CHUNK_SIZE > mio->size)
+    mio->size = (last + 1) * MEM_CHUNK_SIZE;
+
   return 0;
 }
 
@@ -149,4 +328,5 @@ struct ios_dev_if ios_dev_mem
    .get_flags = ios_dev_mem_get_flags,
    .size = ios_dev_mem_size,
    .flush = ios_dev_mem_flush,
+   .nocache = 1,
   };
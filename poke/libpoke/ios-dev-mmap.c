@@ -0,0 +1,337 @@
+/* ios-dev-mmap.c - Memory-mapped file IO devices.  */
+
+/* Copyright (C) 2020 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* We want 64-bit file offsets in all systems.  */
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pk-utils.h"
+#include "ios.h"
+#include "ios-dev.h"
+
+/* mmap devices operate on regular files that are mapped in the
+   address space of the process.  Reading and writing is then just a
+   matter of copying bytes from and to the mapping.  Handlers for this
+   backend have the form mmap://FILENAME.
+
+   If the device is writable, the file is mapped MAP_SHARED so updates
+   go directly to the file.  Writes past the end of the file extend it
+   and the file is then mapped again.  Both the file and the mapping
+   grow geometrically, so a sequence of appending writes doesn't remap
+   the file every time; the size of the data written so far is kept
+   separately, and the file is truncated to it when the device is
+   closed.  */
+
+#define MMAP_PREFIX "mmap://"
+
+/* Reads of at least this number of bytes advise the kernel that the
+   affected pages will be needed soon.  */
+
+#define MMAP_WILLNEED_THRESHOLD 65536
+
+/* Minimum size in bytes of the mapping of a file that is extended by
+   a write.  */
+
+#define MMAP_MIN_GROW 4096
+
+/* State associated with a mmap device.
+
+   SIZE is the size of the data in the file, and MSIZE is the size of
+   both the mapping and the file on disk, which may be bigger if the
+   file has been extended by writes.  */
+
+struct ios_dev_mmap
+{
+  int fd;
+  char *filename;
+  uint8_t *addr;
+  size_t size;
+  size_t msize;
+  uint64_t flags;
+};
+
+static char *
+ios_dev_mmap_handler_normalize (const char *handler, uint64_t flags)
+{
+  if (pk_str_startswith (handler, MMAP_PREFIX)
+      && handler[strlen (MMAP_PREFIX)] != '\0')
+    return strdup (handler);
+  return NULL;
+}
+
+/* Map the first SIZE bytes of the file operated by MIO, replacing any
+   previous mapping.  Return 0 on success, IOD_ERROR otherwise.  */
+
+static int
+ios_dev_mmap_map (struct ios_dev_mmap *mio, size_t size)
+{
+  int prot = PROT_READ;
+  void *addr;
+
+  if (mio->addr != NULL)
+    {
+      munmap (mio->addr, mio->msize);
+      mio->addr = NULL;
+      mio->msize = 0;
+    }
+
+  /* Empty mappings are not allowed.  */
+  if (size == 0)
+    return 0;
+
+  if (mio->flags & IOS_F_WRITE)
+    prot |= PROT_WRITE;
+
+  addr = mmap (NULL, size, prot, MAP_SHARED, mio->fd, 0);
+  if (addr == MAP_FAILED)
+    return IOD_ERROR;
+
+  mio->addr = addr;
+  mio->msize = size;
+  return 0;
+}
+
+static void *
+ios_dev_mmap_open (const char *handler, uint64_t flags, int *error)
+{
+  struct ios_dev_mmap *mio = NULL;
+  const char *filename = handler + strlen (MMAP_PREFIX);
+  uint8_t flags_mode = flags & IOS_FLAGS_MODE;
+  int err = IOD_ERROR;
+  struct stat st;
+  int fd;
+
+  if (flags_mode != 0)
+    {
+      int oflags;
+
+      if (flags_mode == IOS_F_READ)
+        oflags = O_RDONLY;
+      else if (flags_mode == (IOS_F_READ | IOS_F_WRITE))
+        oflags = O_RDWR;
+      else if (flags_mode == (IOS_F_READ | IOS_F_WRITE
+                              | IOS_F_CREATE | IOS_F_TRUNCATE))
+        oflags = O_RDWR | O_CREAT | O_TRUNC;
+      else
+        {
+          /* Invalid mode.  Note that a mapping can't be write-only.  */
+          if (error != NULL)
+            *error = IOD_EINVAL;
+          return NULL;
+        }
+
+      fd = open (filename, oflags, 0666);
+    }
+  else
+    {
+      /* Try read-write initially.
+         If that fails, then try read-only. */
+      fd = open (filename, O_RDWR);
+      flags |= (IOS_F_READ | IOS_F_WRITE);
+      if (fd == -1)
+        {
+          fd = open (filename, O_RDONLY);
+          flags &= ~IOS_F_WRITE;
+        }
+    }
+
+  if (fd == -1)
+    goto err;
+
+  /* Only regular files can be mapped reliably.  */
+  if (fstat (fd, &st) == -1)
+    goto err;
+  if (!S_ISREG (st.st_mode)
+      || (uint64_t) st.st_size > (size_t) -1)
+    {
+      err = IOD_EINVAL;
+      goto err;
+    }
+
+  mio = malloc (sizeof (struct ios_dev_mmap));
+  if (!mio)
+    goto err;
+
+  mio->filename = strdup (filename);
+  if (!mio->filename)
+    goto err;
+
+  mio->fd = fd;
+  mio->flags = flags;
+  mio->addr = NULL;
+  mio->size = 0;
+
+  mio->msize = 0;
+
+  if (ios_dev_mmap_map (mio, st.st_size) != 0)
+    goto err;
+  mio->size = st.st_size;
+
+  return mio;
+
+err:
+  if (mio)
+    {
+      free (mio->filename);
+      free (mio);
+    }
+
+  if (fd != -1)
+    close (fd);
+
+  if (error != NULL)
+    *error = err;
+
+  return NULL;
+}
+
+static int
+ios_dev_mmap_close (void *iod)
+{
+  struct ios_dev_mmap *mio = iod;
+  int ret = 1;
+
+  if (mio->addr != NULL)
+    munmap (mio->addr, mio->msize);
+
+  /* Drop the space allocated in advance by extending writes.  */
+  if (mio->msize > mio->size
+      && ftruncate (mio->fd, mio->size) == -1)
+    {
+      perror (mio->filename);
+      ret = IOD_ERROR;
+    }
+
+  if (close (mio->fd) != 0)
+    perror (mio->filename);
+  free (mio->filename);
+  free (mio);
+
+  return ret;
+}
+
+static uint64_t
+ios_dev_mmap_get_flags (void *iod)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  return mio->flags;
+}
+
+static int
+ios_dev_mmap_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  if (offset > mio->size || count > mio->size - offset)
+    return IOD_EOF;
+
+#ifdef HAVE_MADVISE
+  if (count >= MMAP_WILLNEED_THRESHOLD)
+    {
+      long pagesize = sysconf (_SC_PAGESIZE);
+      ios_dev_off start = offset - offset % pagesize;
+
+      madvise (mio->addr + start, offset + count - start, MADV_WILLNEED);
+    }
+#endif
+
+  memcpy (buf, mio->addr + offset, count);
+  return 0;
+}
+
+static int
+ios_dev_mmap_pwrite (void *iod, const void *buf, size_t count,
+                     ios_dev_off offset)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  if (!(mio->flags & IOS_F_WRITE))
+    return IOD_ERROR;
+
+  if (offset > (size_t) -1 || count > (size_t) -1 - offset)
+    return IOD_EOF;
+
+  /* Writing past the end of the mapping extends both the file and the
+     mapping, by at least doubling their size.  */
+  if (offset + count > mio->msize)
+    {
+      size_t old_msize = mio->msize;
+      size_t msize = mio->msize;
+
+      if (msize < MMAP_MIN_GROW)
+        msize = MMAP_MIN_GROW;
+      while (msize < offset + count && msize <= (size_t) -1 / 2)
+        msize *= 2;
+      if (msize < offset + count)
+        msize = offset + count;
+
+      if (ftruncate (mio->fd, msize) == -1)
+        return IOD_ERROR;
+      if (ios_dev_mmap_map (mio, msize) != 0)
+        {
+          /* Try to restore the previous state.  */
+          if (ftruncate (mio->fd, old_msize) == 0)
+            ios_dev_mmap_map (mio, old_msize);
+          return IOD_ERROR;
+        }
+    }
+
+  memcpy (mio->addr + offset, buf, count);
+  if (offset + count > mio->size)
+    mio->size = offset + count;
+  return 0;
+}
+
+static ios_dev_off
+ios_dev_mmap_size (void *iod)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  return mio->size;
+}
+
+static int
+ios_dev_mmap_flush (void *iod, ios_dev_off offset)
+{
+  return IOS_OK;
+}
+
+struct ios_dev_if ios_dev_mmap
+  __attribute__ ((visibility ("hidden"))) =
+  {
+   .handler_normalize = ios_dev_mmap_handler_normalize,
+   .open = ios_dev_mmap_open,
+   .close = ios_dev_mmap_close,
+   .pread = ios_dev_mmap_pread,
+   .pwrite = ios_dev_mmap_pwrite,
+   .get_flags = ios_dev_mmap_get_flags,
+   .size = ios_dev_mmap_size,
+   .flush = ios_dev_mmap_flush,
+   .nocache = 1,
+  };
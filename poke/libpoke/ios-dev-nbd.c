@@ -25,10 +25,76 @@
 
 #include <libnbd.h>
 
+#include "pk-utils.h"
 #include "ios.h"
 #include "ios-dev.h"
 
-/* State associated with an NBD device.  */
+/* NBD devices access the data through the asynchronous API of
+   libnbd, so several requests can be in flight at the same time.
+
+   Reads are sent to the server as they are requested, but once the
+   device detects that the data is being read sequentially, it also
+   requests the next NBD_RA_BLOCK_SIZE blocks ahead of time, up to
+   NBD_RA_NSLOTS of them, so the round trips to the server overlap
+   with the processing of the data already received.
+
+   Writes are coalesced in a buffer while they are contiguous, and
+   the buffer is sent to the server when a non-contiguous write
+   happens, when it reaches NBD_WRITE_MAX_SIZE bytes, or when the
+   device is flushed.  Up to NBD_WRITE_NSLOTS writes can be in flight
+   at the same time.  Flushing the device waits for them to complete,
+   and asks the server to flush its own caches as well.
+
+   The NBD protocol doesn't guarantee any ordering between in-flight
+   requests, so the device waits for the in-flight writes overlapping
+   a range of data before requesting it, or writing it again.  */
+
+#define NBD_RA_BLOCK_SIZE (64 * 1024)
+#define NBD_RA_NSLOTS 8
+#define NBD_WRITE_MAX_SIZE (1024 * 1024)
+#define NBD_WRITE_NSLOTS 8
+
+/* A readahead slot.  BUF contains, or will contain once the request
+   identified by COOKIE completes, SIZE bytes starting at OFFSET.
+   STALE is set if the data was overwritten after it was
+   requested.  */
+
+enum ios_dev_nbd_slot_state
+{
+  NBD_SLOT_FREE,
+  NBD_SLOT_IN_FLIGHT,
+  NBD_SLOT_DONE
+};
+
+struct ios_dev_nbd_slot
+{
+  enum ios_dev_nbd_slot_state state;
+  bool stale;
+  int64_t cookie;
+  ios_dev_off offset;
+  size_t size;
+  uint8_t *buf;
+};
+
+/* An in-flight write of the SIZE bytes in BUF at OFFSET.  */
+
+struct ios_dev_nbd_write
+{
+  int64_t cookie;
+  ios_dev_off offset;
+  size_t size;
+  uint8_t *buf;
+};
+
+/* State associated with an NBD device.
+
+   NEXT_READ is the offset right after the last read data, and is used
+   to detect sequential reads.  RA_NEXT is the offset of the next
+   block to read ahead.
+
+   WBUF contains WLEN coalesced bytes to be written at WOFFSET.  WCAP
+   is the allocated size of WBUF.  WRITE_ERROR_P is set when some
+   in-flight write fails, and reported by the next write or flush.  */
 
 struct ios_dev_nbd
 {
@@ -36,19 +102,226 @@ struct ios_dev_nbd
   char *uri;
   ios_dev_off size;
   uint64_t flags;
+
+  ios_dev_off next_read;
+  ios_dev_off ra_next;
+  struct ios_dev_nbd_slot slots[NBD_RA_NSLOTS];
+
+  uint8_t *wbuf;
+  size_t wcap;
+  size_t wlen;
+  ios_dev_off woffset;
+  struct ios_dev_nbd_write writes[NBD_WRITE_NSLOTS];
+  int nwrites;
+  bool write_error_p;
 };
 
-static bool
-startswith (const char *str, const char *prefix)
+/* Return whether the ranges [A, A + ASIZE) and [B, B + BSIZE)
+   overlap.  */
+
+static inline bool
+overlap_p (ios_dev_off a, size_t asize, ios_dev_off b, size_t bsize)
+{
+  return a < b + bsize && b < a + asize;
+}
+
+/* Wait for the request identified by COOKIE to complete.  Return 0 if
+   it succeeded, -1 otherwise.  */
+
+static int
+ios_dev_nbd_wait (struct nbd_handle *nbd, int64_t cookie)
+{
+  int ret;
+
+  while ((ret = nbd_aio_command_completed (nbd, cookie)) == 0)
+    if (nbd_poll (nbd, -1) == -1)
+      return -1;
+
+  return ret == 1 ? 0 : -1;
+}
+
+/* Wait for the in-flight write with index I of NIO to complete, and
+   forget it.  */
+
+static void
+ios_dev_nbd_retire_write (struct ios_dev_nbd *nio, int i)
+{
+  if (ios_dev_nbd_wait (nio->nbd, nio->writes[i].cookie) == -1)
+    nio->write_error_p = true;
+  free (nio->writes[i].buf);
+
+  memmove (&nio->writes[i], &nio->writes[i + 1],
+           (nio->nwrites - i - 1) * sizeof (nio->writes[0]));
+  nio->nwrites--;
+}
+
+/* Wait for the in-flight writes of NIO that overlap the range
+   [OFFSET, OFFSET + SIZE) to complete.  */
+
+static void
+ios_dev_nbd_wait_writes (struct ios_dev_nbd *nio, ios_dev_off offset,
+                         size_t size)
+{
+  int i = 0;
+
+  while (i < nio->nwrites)
+    {
+      if (overlap_p (nio->writes[i].offset, nio->writes[i].size,
+                     offset, size))
+        ios_dev_nbd_retire_write (nio, i);
+      else
+        i++;
+    }
+}
+
+/* Send the coalesced writes of NIO to the server.  Return 0 on
+   success, IOD_ERROR otherwise.  */
+
+static int
+ios_dev_nbd_write_out (struct ios_dev_nbd *nio)
+{
+  struct ios_dev_nbd_write *w;
+  int64_t cookie;
+  int i;
+
+  if (nio->wlen == 0)
+    return 0;
+
+  /* Readahead data is patched with the coalesced writes while they
+     are in the buffer, but not afterwards.  */
+  for (i = 0; i < NBD_RA_NSLOTS; ++i)
+    {
+      struct ios_dev_nbd_slot *s = &nio->slots[i];
+
+      if (s->state != NBD_SLOT_FREE
+          && overlap_p (s->offset, s->size, nio->woffset, nio->wlen))
+        s->stale = true;
+    }
+
+  ios_dev_nbd_wait_writes (nio, nio->woffset, nio->wlen);
+  if (nio->nwrites == NBD_WRITE_NSLOTS)
+    ios_dev_nbd_retire_write (nio, 0);
+
+  cookie = nbd_aio_pwrite (nio->nbd, nio->wbuf, nio->wlen, nio->woffset,
+                           NBD_NULL_COMPLETION, 0);
+  if (cookie == -1)
+    return IOD_ERROR;
+
+  /* The buffer belongs to the request until it completes.  */
+  w = &nio->writes[nio->nwrites++];
+  w->cookie = cookie;
+  w->offset = nio->woffset;
+  w->size = nio->wlen;
+  w->buf = nio->wbuf;
+
+  nio->wbuf = NULL;
+  nio->wcap = 0;
+  nio->wlen = 0;
+  return 0;
+}
+
+/* Wait for the readahead request of SLOT to complete, if it is in
+   flight.  Return 0 on success, -1 otherwise.  */
+
+static int
+ios_dev_nbd_slot_wait (struct ios_dev_nbd *nio, struct ios_dev_nbd_slot *slot)
+{
+  if (slot->state == NBD_SLOT_IN_FLIGHT)
+    {
+      if (ios_dev_nbd_wait (nio->nbd, slot->cookie) == -1)
+        {
+          slot->state = NBD_SLOT_FREE;
+          return -1;
+        }
+      slot->state = NBD_SLOT_DONE;
+    }
+
+  return 0;
+}
+
+/* Return a readahead slot of NIO that can be used to read ahead the
+   data at OFFSET, or NULL if all the slots hold data that may still
+   be needed.  Slots are reused once the data they hold is stale, or
+   precedes OFFSET.  */
+
+static struct ios_dev_nbd_slot *
+ios_dev_nbd_slot_get (struct ios_dev_nbd *nio, ios_dev_off offset)
+{
+  struct ios_dev_nbd_slot *slot = NULL;
+  int i;
+
+  for (i = 0; i < NBD_RA_NSLOTS; ++i)
+    {
+      struct ios_dev_nbd_slot *s = &nio->slots[i];
+
+      if (s->state == NBD_SLOT_FREE || s->stale)
+        {
+          slot = s;
+          break;
+        }
+      if (s->offset + s->size <= offset
+          && (slot == NULL || s->offset < slot->offset))
+        slot = s;
+    }
+
+  if (slot == NULL)
+    return NULL;
+
+  if (slot->buf == NULL)
+    {
+      slot->buf = malloc (NBD_RA_BLOCK_SIZE);
+      if (slot->buf == NULL)
+        return NULL;
+    }
+
+  /* Errors in discarded readahead requests are irrelevant.  */
+  ios_dev_nbd_slot_wait (nio, slot);
+  slot->state = NBD_SLOT_FREE;
+  slot->stale = false;
+  return slot;
+}
+
+/* Request the blocks following OFFSET ahead of time, if they are not
+   already available.  */
+
+static void
+ios_dev_nbd_readahead (struct ios_dev_nbd *nio, ios_dev_off offset)
 {
-  return strncmp (str, prefix, strlen (prefix)) == 0;
+  ios_dev_off limit;
+
+  if (nio->ra_next < offset)
+    nio->ra_next = offset;
+  limit = offset + NBD_RA_NSLOTS * NBD_RA_BLOCK_SIZE;
+
+  while (nio->ra_next < nio->size && nio->ra_next < limit)
+    {
+      struct ios_dev_nbd_slot *slot = ios_dev_nbd_slot_get (nio, offset);
+      size_t size = NBD_RA_BLOCK_SIZE;
+
+      if (slot == NULL)
+        break;
+
+      if (size > nio->size - nio->ra_next)
+        size = nio->size - nio->ra_next;
+
+      ios_dev_nbd_wait_writes (nio, nio->ra_next, size);
+      slot->cookie = nbd_aio_pread (nio->nbd, slot->buf, size, nio->ra_next,
+                                    NBD_NULL_COMPLETION, 0);
+      if (slot->cookie == -1)
+        break;
+
+      slot->state = NBD_SLOT_IN_FLIGHT;
+      slot->offset = nio->ra_next;
+      slot->size = size;
+      nio->ra_next += size;
+    }
 }
 
 static char *
 ios_dev_nbd_handler_normalize (const char *handler, uint64_t flags)
 {
-  if (startswith (handler, "nbd://")
-      || startswith (handler, "nbd+unix://"))
+  if (pk_str_startswith (handler, "nbd://")
+      || pk_str_startswith (handler, "nbd+unix://"))
     return strdup (handler);
   return NULL;
 }
@@ -104,6 +377,15 @@ ios_dev_nbd_open (const char *handler, uint64_t flags, int *error)
   nio->nbd = nbd;
   nio->size = size;
   nio->flags = flags;
+  nio->next_read = 0;
+  nio->ra_next = 0;
+  memset (nio->slots, 0, sizeof (nio->slots));
+  nio->wbuf = NULL;
+  nio->wcap = 0;
+  nio->wlen = 0;
+  nio->woffset = 0;
+  nio->nwrites = 0;
+  nio->write_error_p = false;
 
   return nio;
 
@@ -123,17 +405,56 @@ ios_dev_nbd_open (const char *handler, uint64_t flags, int *error)
   return NULL;
 }
 
+static int
+ios_dev_nbd_flush (void *iod, ios_dev_off offset)
+{
+  struct ios_dev_nbd *nio = iod;
+  int ret = IOS_OK;
+
+  if (ios_dev_nbd_write_out (nio) != 0)
+    ret = IOS_ERROR;
+
+  while (nio->nwrites > 0)
+    ios_dev_nbd_retire_write (nio, 0);
+
+  if (nio->write_error_p)
+    {
+      nio->write_error_p = false;
+      ret = IOS_ERROR;
+    }
+
+  if (ret == IOS_OK && nbd_can_flush (nio->nbd) == 1)
+    {
+      int64_t cookie = nbd_aio_flush (nio->nbd, NBD_NULL_COMPLETION, 0);
+
+      if (cookie == -1 || ios_dev_nbd_wait (nio->nbd, cookie) == -1)
+        ret = IOS_ERROR;
+    }
+
+  return ret;
+}
+
 static int
 ios_dev_nbd_close (void *iod)
 {
   struct ios_dev_nbd *nio = iod;
+  int i, ret = 1;
+
+  /* Write out the pending data.  The device is closed even if this
+     fails.  */
+  if (ios_dev_nbd_flush (nio, nio->size) != IOS_OK)
+    ret = IOD_ERROR;
 
-  /* Should this flush when possible?  */
+  /* Closing the handle discards the pending readahead requests, so
+     their buffers can be freed afterwards.  */
   nbd_close (nio->nbd);
+  for (i = 0; i < NBD_RA_NSLOTS; ++i)
+    free (nio->slots[i].buf);
+  free (nio->wbuf);
   free (nio->uri);
   free (nio);
 
-  return 1;
+  return ret;
 }
 
 static uint64_t
@@ -148,8 +469,83 @@ static int
 ios_dev_nbd_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_nbd *nio = iod;
+  uint8_t *p = buf;
+  ios_dev_off end;
+  bool sequential_p;
+
+  if (offset > nio->size || count > nio->size - offset)
+    return IOD_EOF;
+  end = offset + count;
+
+  sequential_p = (offset == nio->next_read);
+  nio->next_read = end;
+  if (!sequential_p)
+    nio->ra_next = 0;
 
-  return nbd_pread (nio->nbd, buf, count, offset, 0) == -1 ? IOD_EOF : 0;
+  /* Get as much data as possible from the readahead slots.  */
+  while (offset < end)
+    {
+      struct ios_dev_nbd_slot *slot = NULL;
+      size_t n;
+      int i;
+
+      for (i = 0; i < NBD_RA_NSLOTS; ++i)
+        {
+          struct ios_dev_nbd_slot *s = &nio->slots[i];
+
+          if (s->state != NBD_SLOT_FREE && !s->stale
+              && s->offset <= offset && offset < s->offset + s->size)
+            {
+              slot = s;
+              break;
+            }
+        }
+
+      if (slot == NULL || ios_dev_nbd_slot_wait (nio, slot) == -1)
+        break;
+
+      n = slot->offset + slot->size - offset;
+      if (n > end - offset)
+        n = end - offset;
+      memcpy (p, slot->buf + (offset - slot->offset), n);
+      p += n;
+      offset += n;
+    }
+
+  /* Request the rest of the data, and the data that will likely be
+     needed next, before waiting for it.  */
+  if (offset < end)
+    {
+      int64_t cookie;
+
+      ios_dev_nbd_wait_writes (nio, offset, end - offset);
+      cookie = nbd_aio_pread (nio->nbd, p, end - offset, offset,
+                              NBD_NULL_COMPLETION, 0);
+      if (cookie == -1)
+        return IOD_ERROR;
+
+      if (sequential_p)
+        ios_dev_nbd_readahead (nio, end);
+
+      if (ios_dev_nbd_wait (nio->nbd, cookie) == -1)
+        return IOD_ERROR;
+    }
+  else if (sequential_p)
+    ios_dev_nbd_readahead (nio, end);
+
+  /* Coalesced writes are not in the server yet.  */
+  offset = end - count;
+  if (nio->wlen > 0 && overlap_p (offset, count, nio->woffset, nio->wlen))
+    {
+      ios_dev_off from = offset > nio->woffset ? offset : nio->woffset;
+      ios_dev_off to = (end < nio->woffset + nio->wlen
+                        ? end : nio->woffset + nio->wlen);
+
+      memcpy ((uint8_t *) buf + (from - offset),
+              nio->wbuf + (from - nio->woffset), to - from);
+    }
+
+  return 0;
 }
 
 static int
@@ -157,8 +553,55 @@ ios_dev_nbd_pwrite (void *iod, const void *buf, size_t count,
                     ios_dev_off offset)
 {
   struct ios_dev_nbd *nio = iod;
+  ios_dev_off end;
+
+  if (offset > nio->size || count > nio->size - offset)
+    return IOD_EOF;
+  end = offset + count;
 
-  return nbd_pwrite (nio->nbd, buf, count, offset, 0) == -1 ? IOD_EOF : 0;
+  if (nio->write_error_p)
+    {
+      nio->write_error_p = false;
+      return IOD_ERROR;
+    }
+
+  /* Start a new buffer unless the written data overlaps or follows
+     the coalesced data.  */
+  if (nio->wlen > 0
+      && (offset < nio->woffset
+          || offset > nio->woffset + nio->wlen
+          || end - nio->woffset > NBD_WRITE_MAX_SIZE))
+    {
+      if (ios_dev_nbd_write_out (nio) != 0)
+        return IOD_ERROR;
+    }
+
+  if (nio->wlen == 0)
+    nio->woffset = offset;
+
+  if (end - nio->woffset > nio->wcap)
+    {
+      size_t cap = nio->wcap == 0 ? 4096 : nio->wcap;
+      uint8_t *wbuf;
+
+      while (cap < end - nio->woffset)
+        cap *= 2;
+      wbuf = realloc (nio->wbuf, cap);
+      if (wbuf == NULL)
+        return IOD_ERROR;
+      nio->wbuf = wbuf;
+      nio->wcap = cap;
+    }
+
+  memcpy (nio->wbuf + (offset - nio->woffset), buf, count);
+  if (end - nio->woffset > nio->wlen)
+    nio->wlen = end - nio->woffset;
+
+  if (nio->wlen >= NBD_WRITE_MAX_SIZE
+      && ios_dev_nbd_write_out (nio) != 0)
+    return IOD_ERROR;
+
+  return 0;
 }
 
 static ios_dev_off
@@ -169,12 +612,6 @@ ios_dev_nbd_size (void *iod)
   return nio->size;
 }
 
-static int
-ios_dev_nbd_flush (void *iod, ios_dev_off offset)
-{
-  return IOS_OK;
-}
-
 struct ios_dev_if ios_dev_nbd
   __attribute__ ((visibility ("hidden"))) =
   {
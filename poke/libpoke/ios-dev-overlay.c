@@ -0,0 +1,438 @@
+/* ios-dev-overlay.c - Copy-on-write overlay IO devices.  */
+
+/* Copyright (C) 2020 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pk-utils.h"
+#include "ios.h"
+#include "ios-dev.h"
+
+/* Overlay devices stack on top of another IO space, called the base.
+   Handlers for this backend have the form overlay://ID, where ID is
+   the identifier of the base IO space.
+
+   Data written to an overlay device is stored in memory, and never
+   reaches the base.  Reads are served by merging the written data
+   with the contents of the base, which is accessed through its own
+   cache.  The written data can then be either committed to the base
+   or discarded.
+
+   The written data is stored in a set of extents sorted by offset.
+   Extents never overlap nor touch each other: writes that overlap or
+   are adjacent to existing extents are merged with them.  Extents are
+   kept in an array, so inserting one moves all the extents after it,
+   and N writes that don't merge cost O(N^2) in the worst case, which
+   happens when they are done at decreasing offsets.
+
+   The base is looked up by identifier in every access, so closing it
+   while the overlay is open just makes further accesses to the
+   overlay fail.  */
+
+#define OVERLAY_PREFIX "overlay://"
+
+/* An extent of written data.  DATA contains SIZE bytes starting at
+   the byte OFFSET of the device.  CAP is the allocated size of
+   DATA.  */
+
+struct ios_dev_overlay_extent
+{
+  ios_dev_off offset;
+  size_t size;
+  size_t cap;
+  uint8_t *data;
+};
+
+/* State associated with an overlay device.  */
+
+struct ios_dev_overlay
+{
+  int base_id;
+  uint64_t flags;
+
+  struct ios_dev_overlay_extent *extents;
+  size_t nextents;
+  size_t extents_size;
+};
+
+/* Return the identifier of the base IO space in HANDLER, or -1 if
+   HANDLER is not valid.  */
+
+static int
+ios_dev_overlay_base_id (const char *handler)
+{
+  const char *p = handler + strlen (OVERLAY_PREFIX);
+  char *end;
+  long id;
+
+  if (!pk_str_startswith (handler, OVERLAY_PREFIX)
+      || *p < '0' || *p > '9')
+    return -1;
+
+  id = strtol (p, &end, 10);
+  if (*end != '\0' || id > INT32_MAX)
+    return -1;
+
+  return id;
+}
+
+static char *
+ios_dev_overlay_handler_normalize (const char *handler, uint64_t flags)
+{
+  if (ios_dev_overlay_base_id (handler) != -1)
+    return strdup (handler);
+  return NULL;
+}
+
+static void *
+ios_dev_overlay_open (const char *handler, uint64_t flags, int *error)
+{
+  struct ios_dev_overlay *oio;
+  uint8_t flags_mode = flags & IOS_FLAGS_MODE;
+  int base_id = ios_dev_overlay_base_id (handler);
+  ios base = ios_search_by_id (base_id);
+
+  if (base == NULL)
+    return NULL;
+
+  /* The overlay is never truncated.  */
+  if (flags_mode & (IOS_F_TRUNCATE | IOS_F_CREATE))
+    {
+      if (error != NULL)
+        *error = IOD_EINVAL;
+      return NULL;
+    }
+
+  oio = malloc (sizeof (struct ios_dev_overlay));
+  if (!oio)
+    return NULL;
+
+  oio->base_id = base_id;
+  oio->flags = flags_mode == 0 ? (IOS_F_READ | IOS_F_WRITE) : flags;
+  oio->extents = NULL;
+  oio->nextents = 0;
+  oio->extents_size = 0;
+
+  return oio;
+}
+
+/* Free all the extents of OIO.  */
+
+static void
+ios_dev_overlay_free_extents (struct ios_dev_overlay *oio)
+{
+  size_t i;
+
+  for (i = 0; i < oio->nextents; ++i)
+    free (oio->extents[i].data);
+  oio->nextents = 0;
+}
+
+static int
+ios_dev_overlay_close (void *iod)
+{
+  struct ios_dev_overlay *oio = iod;
+
+  ios_dev_overlay_free_extents (oio);
+  free (oio->extents);
+  free (oio);
+
+  return 1;
+}
+
+static uint64_t
+ios_dev_overlay_get_flags (void *iod)
+{
+  struct ios_dev_overlay *oio = iod;
+
+  return oio->flags;
+}
+
+/* Return the index of the first extent of OIO that ends after
+   OFFSET, or the number of extents if there is no such extent.  */
+
+static size_t
+ios_dev_overlay_lookup (struct ios_dev_overlay *oio, ios_dev_off offset)
+{
+  size_t lo = 0, hi = oio->nextents;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      struct ios_dev_overlay_extent *e = &oio->extents[mid];
+
+      if (e->offset + e->size <= offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+static ios_dev_off
+ios_dev_overlay_size (void *iod)
+{
+  struct ios_dev_overlay *oio = iod;
+  ios base = ios_search_by_id (oio->base_id);
+  ios_dev_off size = base ? ios_size (base) / 8 : 0;
+
+  if (oio->nextents > 0)
+    {
+      struct ios_dev_overlay_extent *e = &oio->extents[oio->nextents - 1];
+
+      if (e->offset + e->size > size)
+        size = e->offset + e->size;
+    }
+
+  return size;
+}
+
+static int
+ios_dev_overlay_pread (void *iod, void *buf, size_t count,
+                       ios_dev_off offset)
+{
+  struct ios_dev_overlay *oio = iod;
+  ios base = ios_search_by_id (oio->base_id);
+  uint8_t *p = buf;
+  ios_dev_off base_size, end;
+  size_t i;
+
+  if (base == NULL)
+    return IOD_ERROR;
+
+  base_size = ios_size (base) / 8;
+  if (offset > ios_dev_overlay_size (oio)
+      || count > ios_dev_overlay_size (oio) - offset)
+    return IOD_EOF;
+
+  end = offset + count;
+  i = ios_dev_overlay_lookup (oio, offset);
+  while (offset < end)
+    {
+      struct ios_dev_overlay_extent *e
+        = i < oio->nextents ? &oio->extents[i] : NULL;
+      size_t n;
+
+      if (e && e->offset <= offset)
+        {
+          /* Written data.  */
+          n = e->offset + e->size - offset;
+          if (n > end - offset)
+            n = end - offset;
+          memcpy (p, e->data + (offset - e->offset), n);
+          i++;
+        }
+      else
+        {
+          /* Data from the base, up to the next extent.  Data past the
+             end of the base reads as zeros.  */
+          ios_dev_off gap_end = e && e->offset < end ? e->offset : end;
+
+          n = gap_end - offset;
+          if (offset < base_size)
+            {
+              size_t nbase = n;
+
+              if (nbase > base_size - offset)
+                nbase = base_size - offset;
+              if (ios_read_raw (base, offset, nbase, p) != IOS_OK)
+                return IOD_ERROR;
+              memset (p + nbase, 0, n - nbase);
+            }
+          else
+            memset (p, 0, n);
+        }
+
+      p += n;
+      offset += n;
+    }
+
+  return 0;
+}
+
+static int
+ios_dev_overlay_pwrite (void *iod, const void *buf, size_t count,
+                        ios_dev_off offset)
+{
+  struct ios_dev_overlay *oio = iod;
+  struct ios_dev_overlay_extent *e;
+  ios_dev_off start, end;
+  size_t lo, hi, j;
+
+  if (count == 0)
+    return 0;
+
+  if (count > (ios_dev_off) -1 - offset)
+    return IOD_EOF;
+
+  /* Find the extents [LO, HI) that overlap or touch the written
+     range, and compute the range covered by the merged extent.  */
+  start = offset;
+  end = offset + count;
+  lo = ios_dev_overlay_lookup (oio, offset ? offset - 1 : 0);
+  for (hi = lo; hi < oio->nextents && oio->extents[hi].offset <= end; ++hi)
+    ;
+
+  if (lo < hi)
+    {
+      if (oio->extents[lo].offset < start)
+        start = oio->extents[lo].offset;
+      if (oio->extents[hi - 1].offset + oio->extents[hi - 1].size > end)
+        end = oio->extents[hi - 1].offset + oio->extents[hi - 1].size;
+    }
+
+  if (end - start > (size_t) -1 / 2)
+    return IOD_ERROR;
+
+  if (lo < hi && oio->extents[lo].offset == start)
+    {
+      /* Grow the first extent.  */
+      e = &oio->extents[lo];
+      if (e->cap < end - start)
+        {
+          size_t cap = e->cap;
+          uint8_t *data;
+
+          while (cap < end - start)
+            cap *= 2;
+          data = realloc (e->data, cap);
+          if (!data)
+            return IOD_ERROR;
+          e->data = data;
+          e->cap = cap;
+        }
+    }
+  else
+    {
+      /* Make room for a new extent at LO.  */
+      struct ios_dev_overlay_extent new_extent;
+
+      new_extent.offset = start;
+      new_extent.size = 0;
+      new_extent.cap = end - start;
+      new_extent.data = malloc (new_extent.cap);
+      if (!new_extent.data)
+        return IOD_ERROR;
+
+      if (oio->nextents == oio->extents_size)
+        {
+          size_t size = oio->extents_size == 0 ? 16 : oio->extents_size * 2;
+          struct ios_dev_overlay_extent *extents
+            = realloc (oio->extents, size * sizeof (*extents));
+
+          if (!extents)
+            {
+              free (new_extent.data);
+              return IOD_ERROR;
+            }
+          oio->extents = extents;
+          oio->extents_size = size;
+        }
+
+      memmove (&oio->extents[lo + 1], &oio->extents[lo],
+               (oio->nextents - lo) * sizeof (*oio->extents));
+      oio->extents[lo] = new_extent;
+      oio->nextents++;
+      hi++;
+      e = &oio->extents[lo];
+    }
+
+  /* Move the data of the other merged extents into E, and remove
+     them.  */
+  for (j = lo + 1; j < hi; ++j)
+    {
+      struct ios_dev_overlay_extent *m = &oio->extents[j];
+
+      memcpy (e->data + (m->offset - start), m->data, m->size);
+      free (m->data);
+    }
+  memmove (&oio->extents[lo + 1], &oio->extents[hi],
+           (oio->nextents - hi) * sizeof (*oio->extents));
+  oio->nextents -= hi - lo - 1;
+
+  memcpy (e->data + (offset - start), buf, count);
+  e->size = end - start;
+
+  return 0;
+}
+
+static int
+ios_dev_overlay_flush (void *iod, ios_dev_off offset)
+{
+  return IOS_OK;
+}
+
+int
+ios_dev_overlay_commit (void *iod)
+{
+  struct ios_dev_overlay *oio = iod;
+  ios base = ios_search_by_id (oio->base_id);
+  size_t i;
+
+  if (base == NULL)
+    return IOS_ERROR;
+
+  for (i = 0; i < oio->nextents; ++i)
+    {
+      struct ios_dev_overlay_extent *e = &oio->extents[i];
+      int ret = ios_write_raw (base, e->offset, e->size, e->data);
+
+      if (ret != IOS_OK)
+        return ret;
+    }
+
+  ios_dev_overlay_free_extents (oio);
+  return IOS_OK;
+}
+
+void
+ios_dev_overlay_discard (void *iod)
+{
+  ios_dev_overlay_free_extents (iod);
+}
+
+void
+ios_dev_overlay_map (void *iod,
+                     void (*cb) (ios_dev_off offset, size_t size,
+                                 void *data),
+                     void *data)
+{
+  struct ios_dev_overlay *oio = iod;
+  size_t i;
+
+  for (i = 0; i < oio->nextents; ++i)
+    cb (oio->extents[i].offset, oio->extents[i].size, data);
+}
+
+struct ios_dev_if ios_dev_overlay
+  __attribute__ ((visibility ("hidden"))) =
+  {
+   .handler_normalize = ios_dev_overlay_handler_normalize,
+   .open = ios_dev_overlay_open,
+   .close = ios_dev_overlay_close,
+   .pread = ios_dev_overlay_pread,
+   .pwrite = ios_dev_overlay_pwrite,
+   .get_flags = ios_dev_overlay_get_flags,
+   .size = ios_dev_overlay_size,
+   .flush = ios_dev_overlay_flush,
+   .nocache = 1,
+  };
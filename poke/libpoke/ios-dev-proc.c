@@ -0,0 +1,425 @@
+/* ios-dev-proc.c - Process memory IO devices.  */
+
+/* Copyright (C) 2020 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* We want 64-bit file offsets in all systems.  */
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#if defined HAVE_PROCESS_VM_READV || defined HAVE_PROCESS_VM_WRITEV
+# include <sys/uio.h>
+#endif
+
+#include "pk-utils.h"
+#include "ios.h"
+#include "ios-dev.h"
+
+/* Process devices provide access to the address space of a running
+   process.  Handlers for this backend have the form pid://PID.
+
+   The device keeps the list of memory mappings of the process, read
+   from /proc/PID/maps when the device is opened and every time it is
+   flushed.  Accesses to addresses that are not mapped fail right away
+   with IOD_EOF, without involving the process.  The size of the
+   device is the end of the last mapping.
+
+   Data is transferred with process_vm_readv and process_vm_writev
+   when they are available, using /proc/PID/mem otherwise.  Unlike
+   process_vm_writev, /proc/PID/mem allows writing to read-only
+   mappings, so it is also used when process_vm_writev fails to do
+   so.
+
+   The memory of the process may change at any time, so the device is
+   live: writes go straight to the process, and flushing the IO space
+   discards the data read so far.
+
+   Process devices are opened read-only unless IOS_F_WRITE is
+   specified.  */
+
+#define PROC_PREFIX "pid://"
+
+/* A memory mapping of the process, covering the addresses in the
+   range [START, END).  */
+
+struct ios_dev_proc_map
+{
+  ios_dev_off start;
+  ios_dev_off end;
+};
+
+/* State associated with a process device.  MEM_FD is a file
+   descriptor for /proc/PID/mem, or -1 if it couldn't be opened.  */
+
+struct ios_dev_proc
+{
+  pid_t pid;
+  int mem_fd;
+  uint64_t flags;
+
+  struct ios_dev_proc_map *maps;
+  size_t nmaps;
+  size_t maps_size;
+};
+
+/* Return the PID in HANDLER, or -1 if HANDLER is not valid.  */
+
+static pid_t
+ios_dev_proc_pid (const char *handler)
+{
+  const char *p = handler + strlen (PROC_PREFIX);
+  char *end;
+  long pid;
+
+  if (!pk_str_startswith (handler, PROC_PREFIX)
+      || *p < '0' || *p > '9')
+    return -1;
+
+  errno = 0;
+  pid = strtol (p, &end, 10);
+  if (errno != 0 || *end != '\0' || pid <= 0 || pid > INT32_MAX)
+    return -1;
+
+  return pid;
+}
+
+/* Read the list of mappings of the process of PIO from
+   /proc/PID/maps.  Mappings that are adjacent are merged.  Return 0
+   on success, IOD_ERROR otherwise.  */
+
+static int
+ios_dev_proc_read_maps (struct ios_dev_proc *pio)
+{
+  char path[64];
+  char *line = NULL;
+  size_t line_size = 0;
+  FILE *fp;
+  int ret = 0;
+
+  sprintf (path, "/proc/%d/maps", (int) pio->pid);
+  fp = fopen (path, "r");
+  if (fp == NULL)
+    return IOD_ERROR;
+
+  pio->nmaps = 0;
+  while (getline (&line, &line_size, fp) != -1)
+    {
+      struct ios_dev_proc_map *last
+        = pio->nmaps > 0 ? &pio->maps[pio->nmaps - 1] : NULL;
+      ios_dev_off start, end;
+      char *p;
+
+      start = strtoull (line, &p, 16);
+      if (*p != '-')
+        continue;
+      end = strtoull (p + 1, &p, 16);
+
+      /* The offsets in the IOS are measured in bits, so mappings at
+         the very top of the address space, like the vsyscall page in
+         some systems, are not accessible.  */
+      if (end <= start || end > (ios_dev_off) -1 / 8)
+        continue;
+
+      if (last && last->end == start)
+        {
+          last->end = end;
+          continue;
+        }
+
+      if (pio->nmaps == pio->maps_size)
+        {
+          size_t size = pio->maps_size == 0 ? 64 : pio->maps_size * 2;
+          struct ios_dev_proc_map *maps
+            = realloc (pio->maps, size * sizeof (*maps));
+
+          if (maps == NULL)
+            {
+              ret = IOD_ERROR;
+              break;
+            }
+          pio->maps = maps;
+          pio->maps_size = size;
+        }
+
+      pio->maps[pio->nmaps].start = start;
+      pio->maps[pio->nmaps].end = end;
+      pio->nmaps++;
+    }
+
+  free (line);
+  fclose (fp);
+  return ret;
+}
+
+/* Return whether the range [OFFSET, OFFSET + COUNT) is entirely
+   mapped in the process of PIO.  */
+
+static bool
+ios_dev_proc_mapped_p (struct ios_dev_proc *pio, ios_dev_off offset,
+                       size_t count)
+{
+  size_t lo = 0, hi = pio->nmaps;
+
+  /* Find the first mapping that ends after OFFSET.  Since adjacent
+     mappings are merged, the range is mapped only if it is contained
+     in that mapping.  */
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (pio->maps[mid].end <= offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return (lo < pio->nmaps
+          && pio->maps[lo].start <= offset
+          && count <= pio->maps[lo].end - offset);
+}
+
+static char *
+ios_dev_proc_handler_normalize (const char *handler, uint64_t flags)
+{
+  if (ios_dev_proc_pid (handler) != -1)
+    return strdup (handler);
+  return NULL;
+}
+
+static void *
+ios_dev_proc_open (const char *handler, uint64_t flags, int *error)
+{
+  struct ios_dev_proc *pio;
+  uint8_t flags_mode = flags & IOS_FLAGS_MODE;
+  char path[64];
+
+  /* The address space of a process can't be truncated nor
+     created.  */
+  if (flags_mode & (IOS_F_TRUNCATE | IOS_F_CREATE))
+    {
+      if (error != NULL)
+        *error = IOD_EINVAL;
+      return NULL;
+    }
+
+  pio = malloc (sizeof (struct ios_dev_proc));
+  if (!pio)
+    return NULL;
+
+  pio->pid = ios_dev_proc_pid (handler);
+  pio->flags = flags_mode == 0 ? IOS_F_READ : flags;
+  pio->maps = NULL;
+  pio->nmaps = 0;
+  pio->maps_size = 0;
+
+  if (ios_dev_proc_read_maps (pio) != 0)
+    goto err;
+
+  sprintf (path, "/proc/%d/mem", (int) pio->pid);
+  pio->mem_fd = open (path, (pio->flags & IOS_F_WRITE) ? O_RDWR : O_RDONLY);
+
+#if !defined HAVE_PROCESS_VM_READV
+  if (pio->mem_fd == -1)
+    goto err;
+#endif
+
+  return pio;
+
+ err:
+  free (pio->maps);
+  free (pio);
+  return NULL;
+}
+
+static int
+ios_dev_proc_close (void *iod)
+{
+  struct ios_dev_proc *pio = iod;
+
+  if (pio->mem_fd != -1 && close (pio->mem_fd) != 0)
+    perror ("close");
+  free (pio->maps);
+  free (pio);
+
+  return 1;
+}
+
+static uint64_t
+ios_dev_proc_get_flags (void *iod)
+{
+  struct ios_dev_proc *pio = iod;
+
+  return pio->flags;
+}
+
+/* Transfer COUNT bytes between BUF and the address OFFSET of the
+   process of PIO using /proc/PID/mem.  Return 0 on success, IOD_EOF
+   if the memory is not accessible, or IOD_ERROR otherwise.  */
+
+static int
+ios_dev_proc_mem_xfer (struct ios_dev_proc *pio, bool write_p, void *buf,
+                       size_t count, ios_dev_off offset)
+{
+  uint8_t *p = buf;
+
+  if (pio->mem_fd == -1)
+    return IOD_ERROR;
+
+  while (count > 0)
+    {
+      ssize_t ret = (write_p
+                     ? pwrite (pio->mem_fd, p, count, offset)
+                     : pread (pio->mem_fd, p, count, offset));
+
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret == -1 && errno == EIO)
+        return IOD_EOF;
+      if (ret <= 0)
+        return IOD_ERROR;
+
+      p += ret;
+      offset += ret;
+      count -= ret;
+    }
+
+  return 0;
+}
+
+static int
+ios_dev_proc_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_proc *pio = iod;
+
+  if (!ios_dev_proc_mapped_p (pio, offset, count))
+    return IOD_EOF;
+
+#ifdef HAVE_PROCESS_VM_READV
+  {
+    uint8_t *p = buf;
+
+    while (count > 0)
+      {
+        struct iovec local = { p, count };
+        struct iovec remote = { (void *) (uintptr_t) offset, count };
+        ssize_t ret = process_vm_readv (pio->pid, &local, 1, &remote, 1, 0);
+
+        if (ret > 0)
+          {
+            p += ret;
+            offset += ret;
+            count -= ret;
+            continue;
+          }
+
+        if (ret == -1 && errno == EFAULT)
+          return IOD_EOF;
+        if (ret == -1 && errno == ENOSYS)
+          break;
+        return IOD_ERROR;
+      }
+
+    if (count == 0)
+      return 0;
+    buf = p;
+  }
+#endif
+
+  return ios_dev_proc_mem_xfer (pio, false, buf, count, offset);
+}
+
+static int
+ios_dev_proc_pwrite (void *iod, const void *buf, size_t count,
+                     ios_dev_off offset)
+{
+  struct ios_dev_proc *pio = iod;
+
+  if (!ios_dev_proc_mapped_p (pio, offset, count))
+    return IOD_EOF;
+
+#ifdef HAVE_PROCESS_VM_WRITEV
+  {
+    const uint8_t *p = buf;
+
+    while (count > 0)
+      {
+        struct iovec local = { (void *) p, count };
+        struct iovec remote = { (void *) (uintptr_t) offset, count };
+        ssize_t ret = process_vm_writev (pio->pid, &local, 1, &remote, 1, 0);
+
+        if (ret > 0)
+          {
+            p += ret;
+            offset += ret;
+            count -= ret;
+            continue;
+          }
+
+        /* EFAULT is also reported for read-only mappings, which
+           /proc/PID/mem is able to write to.  */
+        if (ret == -1 && (errno == EFAULT || errno == ENOSYS))
+          break;
+        return IOD_ERROR;
+      }
+
+    if (count == 0)
+      return 0;
+    buf = p;
+  }
+#endif
+
+  return ios_dev_proc_mem_xfer (pio, true, (void *) buf, count, offset);
+}
+
+static ios_dev_off
+ios_dev_proc_size (void *iod)
+{
+  struct ios_dev_proc *pio = iod;
+
+  return pio->nmaps > 0 ? pio->maps[pio->nmaps - 1].end : 0;
+}
+
+static int
+ios_dev_proc_flush (void *iod, ios_dev_off offset)
+{
+  struct ios_dev_proc *pio = iod;
+
+  /* The process may have changed its mappings.  */
+  return ios_dev_proc_read_maps (pio) == 0 ? IOS_OK : IOS_ERROR;
+}
+
+struct ios_dev_if ios_dev_proc
+  __attribute__ ((visibility ("hidden"))) =
+  {
+   .handler_normalize = ios_dev_proc_handler_normalize,
+   .open = ios_dev_proc_open,
+   .close = ios_dev_proc_close,
+   .pread = ios_dev_proc_pread,
+   .pwrite = ios_dev_proc_pwrite,
+   .get_flags = ios_dev_proc_get_flags,
+   .size = ios_dev_proc_size,
+   .flush = ios_dev_proc_flush,
+   .live = 1,
+  };
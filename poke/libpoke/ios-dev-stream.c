@@ -0,0 +1,414 @@
+/* ios-dev-stream.c - Streaming IO devices.  */
+
+/* Copyright (C) 2020 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* We want 64-bit file offsets in all systems.  */
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+/* Stream devices operate on file descriptors that don't support
+   random access, like the standard input and output of the process,
+   pipes and named FIFOs.  Handlers for this backend are <stdin>,
+   <stdout>, <stderr>, and the name of any FIFO in the file system.
+
+   An in-stream is read-only.  Data is read from the file descriptor
+   as it is requested, and kept in a buffer that starts at the offset
+   passed to the last flush.  Reading data before that offset is not
+   possible.
+
+   An out-stream is write-only.  Data written to the device is kept in
+   a buffer that starts at the offset passed to the last flush, and is
+   written to the file descriptor, in order, when the device is
+   flushed or closed.  Writing data before that offset is not
+   possible.  Data in the buffer can be read back, which is needed by
+   the read-modify-write sequences performed by the IO space when
+   writing integers that are not aligned to byte boundaries.
+
+   FIFOs are opened as in-streams unless IOS_F_WRITE is specified in
+   the flags.  */
+
+#define STREAM_STDIN "<stdin>"
+#define STREAM_STDOUT "<stdout>"
+#define STREAM_STDERR "<stderr>"
+
+/* Minimum number of bytes to read from an in-stream at a time, and
+   minimum size of the buffers.  */
+
+#define STREAM_CHUNK_SIZE 4096
+
+/* State associated with a stream device.
+
+   BUF contains LEN bytes of the stream starting at BEGIN.  CAP is the
+   allocated size of BUF.
+
+   For in-streams, BEGIN + LEN is the number of bytes read from FD so
+   far.  FLUSHED is the offset passed to the last flush, which can be
+   bigger than BEGIN + LEN: in that case the bytes in between are
+   discarded as soon as they are read.  BEGIN is never bigger than
+   FLUSHED.  EOF_P is set once FD reaches end of file.
+
+   For out-streams, BEGIN is the number of bytes written to FD so
+   far.  */
+
+struct ios_dev_stream
+{
+  int fd;
+  bool close_p;
+  bool write_p;
+  uint64_t flags;
+
+  uint8_t *buf;
+  size_t cap;
+  size_t len;
+  ios_dev_off begin;
+  ios_dev_off flushed;
+  bool eof_p;
+};
+
+static bool
+ios_dev_stream_fifo_p (const char *handler)
+{
+  struct stat st;
+
+  return stat (handler, &st) == 0 && S_ISFIFO (st.st_mode);
+}
+
+static char *
+ios_dev_stream_handler_normalize (const char *handler, uint64_t flags)
+{
+  char *newhandler = NULL;
+
+  if (strcmp (handler, STREAM_STDIN) == 0
+      || strcmp (handler, STREAM_STDOUT) == 0
+      || strcmp (handler, STREAM_STDERR) == 0)
+    return strdup (handler);
+
+  if (ios_dev_stream_fifo_p (handler))
+    IOS_FILE_HANDLER_NORMALIZE (handler, newhandler);
+
+  return newhandler;
+}
+
+static void *
+ios_dev_stream_open (const char *handler, uint64_t flags, int *error)
+{
+  struct ios_dev_stream *sio;
+  uint8_t flags_mode = flags & IOS_FLAGS_MODE;
+  int fd;
+  bool write_p;
+  bool close_p = false;
+
+  if (strcmp (handler, STREAM_STDIN) == 0)
+    {
+      fd = STDIN_FILENO;
+      write_p = false;
+    }
+  else if (strcmp (handler, STREAM_STDOUT) == 0)
+    {
+      fd = STDOUT_FILENO;
+      write_p = true;
+    }
+  else if (strcmp (handler, STREAM_STDERR) == 0)
+    {
+      fd = STDERR_FILENO;
+      write_p = true;
+    }
+  else
+    {
+      write_p = (flags_mode & IOS_F_WRITE) != 0;
+      fd = -2;
+    }
+
+  /* Streams can't be both read and written.  */
+  if (flags_mode != 0
+      && flags_mode != (write_p ? IOS_F_WRITE : IOS_F_READ))
+    {
+      if (error != NULL)
+        *error = IOD_EINVAL;
+      return NULL;
+    }
+
+  if (fd == -2)
+    {
+      fd = open (handler, write_p ? O_WRONLY : O_RDONLY);
+      if (fd == -1)
+        return NULL;
+      close_p = true;
+    }
+
+  sio = malloc (sizeof (struct ios_dev_stream));
+  if (!sio)
+    goto err;
+
+  sio->buf = malloc (STREAM_CHUNK_SIZE);
+  if (!sio->buf)
+    goto err;
+
+  sio->fd = fd;
+  sio->close_p = close_p;
+  sio->write_p = write_p;
+  sio->flags = write_p ? IOS_F_WRITE : IOS_F_READ;
+  sio->cap = STREAM_CHUNK_SIZE;
+  sio->len = 0;
+  sio->begin = 0;
+  sio->flushed = 0;
+  sio->eof_p = false;
+
+  return sio;
+
+ err:
+  free (sio);
+  if (close_p)
+    close (fd);
+  return NULL;
+}
+
+/* Make sure the buffer of SIO can hold at least SIZE bytes.  Return
+   0 on success, IOD_ERROR otherwise.  */
+
+static int
+ios_dev_stream_reserve (struct ios_dev_stream *sio, ios_dev_off size)
+{
+  size_t cap = sio->cap;
+  uint8_t *buf;
+
+  if (size <= cap)
+    return 0;
+
+  if (size > (size_t) -1 / 2)
+    return IOD_ERROR;
+
+  while (cap < size)
+    cap *= 2;
+
+  buf = realloc (sio->buf, cap);
+  if (!buf)
+    return IOD_ERROR;
+
+  sio->buf = buf;
+  sio->cap = cap;
+  return 0;
+}
+
+/* Discard the first COUNT bytes of the buffer of SIO.  */
+
+static void
+ios_dev_stream_discard (struct ios_dev_stream *sio, size_t count)
+{
+  memmove (sio->buf, sio->buf + count, sio->len - count);
+  sio->len -= count;
+  sio->begin += count;
+}
+
+/* Write all the bytes of the buffer of the out-stream SIO before
+   OFFSET to the file descriptor.  Return 0 on success, IOD_ERROR
+   otherwise.  */
+
+static int
+ios_dev_stream_write_out (struct ios_dev_stream *sio, ios_dev_off offset)
+{
+  size_t count, written = 0;
+
+  if (offset <= sio->begin)
+    return 0;
+
+  count = offset - sio->begin;
+  if (count > sio->len)
+    count = sio->len;
+
+  while (written < count)
+    {
+      ssize_t ret = write (sio->fd, sio->buf + written, count - written);
+
+      if (ret == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          /* Keep what couldn't be written.  */
+          ios_dev_stream_discard (sio, written);
+          return IOD_ERROR;
+        }
+
+      written += ret;
+    }
+
+  ios_dev_stream_discard (sio, count);
+  return 0;
+}
+
+static int
+ios_dev_stream_close (void *iod)
+{
+  struct ios_dev_stream *sio = iod;
+
+  if (sio->write_p)
+    ios_dev_stream_write_out (sio, sio->begin + sio->len);
+  if (sio->close_p && close (sio->fd) != 0)
+    perror ("close");
+  free (sio->buf);
+  free (sio);
+
+  return 1;
+}
+
+static uint64_t
+ios_dev_stream_get_flags (void *iod)
+{
+  struct ios_dev_stream *sio = iod;
+
+  return sio->flags;
+}
+
+static int
+ios_dev_stream_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_stream *sio = iod;
+  ios_dev_off end;
+
+  /* Data before the last flush is no longer available.  */
+  if (offset < sio->begin || offset < sio->flushed)
+    return IOD_EOF;
+
+  if (count > (ios_dev_off) -1 - offset)
+    return IOD_EOF;
+  end = offset + count;
+
+  /* Read from the file descriptor until the requested data is in the
+     buffer.  */
+  while (!sio->write_p && !sio->eof_p && sio->begin + sio->len < end)
+    {
+      ssize_t ret;
+
+      if (sio->len == sio->cap
+          && ios_dev_stream_reserve (sio, sio->cap + 1) != 0)
+        return IOD_ERROR;
+
+      ret = read (sio->fd, sio->buf + sio->len, sio->cap - sio->len);
+      if (ret == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          return IOD_ERROR;
+        }
+      if (ret == 0)
+        sio->eof_p = true;
+      sio->len += ret;
+
+      /* Drop data that was flushed before being read.  */
+      if (sio->begin < sio->flushed)
+        {
+          ios_dev_off n = sio->flushed - sio->begin;
+
+          ios_dev_stream_discard (sio, n < sio->len ? n : sio->len);
+        }
+    }
+
+  if (sio->begin + sio->len < end)
+    return IOD_EOF;
+
+  memcpy (buf, sio->buf + (offset - sio->begin), count);
+  return 0;
+}
+
+static int
+ios_dev_stream_pwrite (void *iod, const void *buf, size_t count,
+                       ios_dev_off offset)
+{
+  struct ios_dev_stream *sio = iod;
+  ios_dev_off end;
+
+  if (!sio->write_p)
+    return IOD_ERROR;
+
+  /* Data before the last flush has already been written out.  */
+  if (offset < sio->begin)
+    return IOD_EOF;
+
+  if (count > (ios_dev_off) -1 - offset)
+    return IOD_EOF;
+  end = offset + count;
+
+  if (ios_dev_stream_reserve (sio, end - sio->begin) != 0)
+    return IOD_ERROR;
+
+  /* Gaps between the buffered data and the written data are filled
+     with zeros.  */
+  if (offset > sio->begin + sio->len)
+    memset (sio->buf + sio->len, 0, offset - sio->begin - sio->len);
+
+  memcpy (sio->buf + (offset - sio->begin), buf, count);
+  if (end > sio->begin + sio->len)
+    sio->len = end - sio->begin;
+
+  return 0;
+}
+
+static ios_dev_off
+ios_dev_stream_size (void *iod)
+{
+  struct ios_dev_stream *sio = iod;
+
+  return sio->begin + sio->len;
+}
+
+static int
+ios_dev_stream_flush (void *iod, ios_dev_off offset)
+{
+  struct ios_dev_stream *sio = iod;
+
+  if (sio->write_p)
+    return ios_dev_stream_write_out (sio, offset) == 0 ? IOS_OK : IOS_ERROR;
+
+  if (offset > sio->flushed)
+    {
+      ios_dev_off count;
+
+      sio->flushed = offset;
+      count = offset - sio->begin;
+      ios_dev_stream_discard (sio, count < sio->len ? count : sio->len);
+    }
+
+  return IOS_OK;
+}
+
+struct ios_dev_if ios_dev_stream
+  __attribute__ ((visibility ("hidden"))) =
+  {
+   .handler_normalize = ios_dev_stream_handler_normalize,
+   .open = ios_dev_stream_open,
+   .close = ios_dev_stream_close,
+   .pread = ios_dev_stream_pread,
+   .pwrite = ios_dev_stream_pwrite,
+   .get_flags = ios_dev_stream_get_flags,
+   .size = ios_dev_stream_size,
+   .flush = ios_dev_stream_flush,
+   .nocache = 1,
+   .stream = 1,
+  };
@@ -0,0 +1,236 @@
+/* ios-dev-sub.c - Sub-range IO devices.  */
+
+/* Copyright (C) 2020 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pk-utils.h"
+#include "ios.h"
+#include "ios-dev.h"
+
+/* Sub devices provide access to a window of another IO space, called
+   the parent.  Handlers for this backend have the form
+   sub://ID/BASE/SIZE, where ID is the identifier of the parent IO
+   space, and BASE and SIZE are the offset and size in bytes of the
+   window in the parent.  BASE and SIZE can be written in decimal or,
+   prefixed with 0x, in hexadecimal.
+
+   Accesses to the device are forwarded to the parent, through its
+   cache, and are not allowed to go past the end of the window.  Since
+   the parent is itself an IO space, sub devices can be nested.
+
+   The parent is looked up by identifier in every access, so closing
+   it while the sub device is open just makes further accesses to the
+   sub device fail.  */
+
+#define SUB_PREFIX "sub://"
+
+/* State associated with a sub device.  */
+
+struct ios_dev_sub
+{
+  int parent_id;
+  ios_dev_off base;
+  ios_dev_off size;
+  uint64_t flags;
+};
+
+/* Parse the unsigned number at *P, which must be followed by the
+   character END, and advance *P past END.  Return true on success,
+   false otherwise.  */
+
+static bool
+ios_dev_sub_parse_number (const char **p, char end, uint64_t *number)
+{
+  char *q;
+
+  if (**p < '0' || **p > '9')
+    return false;
+
+  errno = 0;
+  *number = strtoull (*p, &q, 0);
+  if (errno != 0 || *q != end)
+    return false;
+
+  *p = end == '\0' ? q : q + 1;
+  return true;
+}
+
+/* Parse HANDLER into SIO.  Return true if HANDLER is a valid sub
+   handler, false otherwise.  */
+
+static bool
+ios_dev_sub_parse_handler (const char *handler, struct ios_dev_sub *sio)
+{
+  const char *p = handler + strlen (SUB_PREFIX);
+  uint64_t id;
+
+  if (!pk_str_startswith (handler, SUB_PREFIX)
+      || !ios_dev_sub_parse_number (&p, '/', &id)
+      || !ios_dev_sub_parse_number (&p, '/', &sio->base)
+      || !ios_dev_sub_parse_number (&p, '\0', &sio->size))
+    return false;
+
+  /* The window shall fit in the parent's address space.  */
+  if (id > INT32_MAX
+      || sio->size > (ios_dev_off) -1 - sio->base)
+    return false;
+
+  sio->parent_id = id;
+  return true;
+}
+
+static char *
+ios_dev_sub_handler_normalize (const char *handler, uint64_t flags)
+{
+  struct ios_dev_sub sio;
+
+  if (ios_dev_sub_parse_handler (handler, &sio))
+    return strdup (handler);
+  return NULL;
+}
+
+static void *
+ios_dev_sub_open (const char *handler, uint64_t flags, int *error)
+{
+  struct ios_dev_sub *sio;
+  uint8_t flags_mode = flags & IOS_FLAGS_MODE;
+  ios parent;
+
+  sio = malloc (sizeof (struct ios_dev_sub));
+  if (!sio)
+    return NULL;
+
+  if (!ios_dev_sub_parse_handler (handler, sio))
+    goto err;
+
+  parent = ios_search_by_id (sio->parent_id);
+  if (parent == NULL)
+    goto err;
+
+  /* Windows can't be truncated nor created.  */
+  if (flags_mode & (IOS_F_TRUNCATE | IOS_F_CREATE))
+    {
+      if (error != NULL)
+        *error = IOD_EINVAL;
+      goto err;
+    }
+
+  /* By default the window inherits the mode of the parent.  */
+  sio->flags = flags_mode == 0 ? ios_flags (parent) : flags;
+  return sio;
+
+ err:
+  free (sio);
+  return NULL;
+}
+
+static int
+ios_dev_sub_close (void *iod)
+{
+  free (iod);
+  return 1;
+}
+
+static uint64_t
+ios_dev_sub_get_flags (void *iod)
+{
+  struct ios_dev_sub *sio = iod;
+
+  return sio->flags;
+}
+
+static ios_dev_off
+ios_dev_sub_size (void *iod)
+{
+  struct ios_dev_sub *sio = iod;
+
+  return sio->size;
+}
+
+/* Translate the status RET of an access to the parent IO space into a
+   device status.  */
+
+static int
+ios_dev_sub_status (int ret)
+{
+  switch (ret)
+    {
+    case IOS_OK: return 0;
+    case IOS_EIOFF: return IOD_EOF;
+    default: return IOD_ERROR;
+    }
+}
+
+static int
+ios_dev_sub_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_sub *sio = iod;
+  ios parent = ios_search_by_id (sio->parent_id);
+
+  if (parent == NULL)
+    return IOD_ERROR;
+
+  if (offset > sio->size || count > sio->size - offset)
+    return IOD_EOF;
+
+  return ios_dev_sub_status (ios_read_raw (parent, sio->base + offset,
+                                           count, buf));
+}
+
+static int
+ios_dev_sub_pwrite (void *iod, const void *buf, size_t count,
+                    ios_dev_off offset)
+{
+  struct ios_dev_sub *sio = iod;
+  ios parent = ios_search_by_id (sio->parent_id);
+
+  if (parent == NULL)
+    return IOD_ERROR;
+
+  /* Windows don't grow.  */
+  if (offset > sio->size || count > sio->size - offset)
+    return IOD_EOF;
+
+  return ios_dev_sub_status (ios_write_raw (parent, sio->base + offset,
+                                            count, buf));
+}
+
+static int
+ios_dev_sub_flush (void *iod, ios_dev_off offset)
+{
+  return IOS_OK;
+}
+
+struct ios_dev_if ios_dev_sub
+  __attribute__ ((visibility ("hidden"))) =
+  {
+   .handler_normalize = ios_dev_sub_handler_normalize,
+   .open = ios_dev_sub_open,
+   .close = ios_dev_sub_close,
+   .pread = ios_dev_sub_pread,
+   .pwrite = ios_dev_sub_pwrite,
+   .get_flags = ios_dev_sub_get_flags,
+   .size = ios_dev_sub_size,
+   .flush = ios_dev_sub_flush,
+   .nocache = 1,
+  };
@@ -0,0 +1,519 @@
+/* ios-dev-zlib.c - Compressed file IO devices.  */
+
+/* Copyright (C) 2020 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* We want 64-bit file offsets in all systems.  */
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "pk-utils.h"
+#include "ios.h"
+#include "ios-dev.h"
+
+/* zlib devices provide read-only access to the decompressed contents
+   of gzip files.  Handlers for this backend have the form
+   gz://FILENAME.  Files containing several concatenated gzip members
+   are supported.
+
+   Deflate streams can only be decompressed sequentially.  In order to
+   support random access, the whole file is decompressed when the
+   device is opened, and a checkpoint is recorded at the first block
+   boundary found after every ZLIB_SPAN bytes of output.  Each
+   checkpoint contains the position in the compressed and decompressed
+   data, and the last 32 KiB of decompressed data, which is what a
+   decompressor needs in order to resume at that point.  A read is
+   then served by resuming decompression at the closest checkpoint
+   before the requested data, unless the requested data comes shortly
+   after the previous read, in which case decompression just goes
+   on.  */
+
+#define ZLIB_PREFIX "gz://"
+
+/* Distance between checkpoints, in decompressed bytes.  */
+
+#define ZLIB_SPAN (1024 * 1024)
+
+/* Size of the deflate window, and of the buffer used to read
+   compressed data.  */
+
+#define ZLIB_WINSIZE 32768
+#define ZLIB_CHUNK 16384
+
+/* A checkpoint.
+
+   OUT is the offset in the decompressed data.  IN is the offset in
+   the compressed file of the first byte that is not fully consumed.
+   BITS is the number of bits of the byte before IN that are still to
+   be consumed, or zero.
+
+   WINDOW contains the 32 KiB of decompressed data before OUT.  It is
+   NULL for checkpoints at the beginning of a gzip member, which need
+   no history.  */
+
+struct ios_dev_zlib_point
+{
+  ios_dev_off out;
+  off_t in;
+  int bits;
+  uint8_t *window;
+};
+
+/* State associated with a zlib device.
+
+   POINTS is an array of NPOINTS checkpoints sorted by OUT.
+
+   STRM is the state of the decompressor.  RAW_P is set when it is
+   decompressing a raw deflate stream, i.e. it was resumed from a
+   checkpoint in the middle of a gzip member.  SKIP is the number of
+   bytes of the trailer of a gzip member that are still to be skipped
+   before the header of the next member.  MEMBER_P is set when no
+   data has been decompressed from the current gzip member yet.  OUT
+   is the offset in the decompressed data of the next byte it will
+   produce.  EOF_P is set when there is no more data to
+   decompress.
+
+   WINDOW is a circular buffer holding the last ZLIB_WINSIZE bytes
+   produced by the decompressor, WPOS being the position in WINDOW
+   where the next byte will be stored.  */
+
+struct ios_dev_zlib
+{
+  int fd;
+  char *filename;
+  uint64_t flags;
+  ios_dev_off size;
+
+  struct ios_dev_zlib_point *points;
+  size_t npoints;
+  size_t points_size;
+
+  z_stream strm;
+  bool raw_p;
+  int skip;
+  bool member_p;
+  ios_dev_off out;
+  bool eof_p;
+
+  uint8_t window[ZLIB_WINSIZE];
+  size_t wpos;
+  uint8_t inbuf[ZLIB_CHUNK];
+};
+
+static char *
+ios_dev_zlib_handler_normalize (const char *handler, uint64_t flags)
+{
+  if (pk_str_startswith (handler, ZLIB_PREFIX)
+      && handler[strlen (ZLIB_PREFIX)] != '\0')
+    return strdup (handler);
+  return NULL;
+}
+
+/* Add a checkpoint at the current position of ZIO.  If MEMBER_P is
+   set, the checkpoint is at the beginning of a gzip member.  Return 0
+   on success, IOD_ERROR otherwise.  */
+
+static int
+ios_dev_zlib_add_point (struct ios_dev_zlib *zio, bool member_p, off_t in)
+{
+  struct ios_dev_zlib_point *point;
+
+  if (zio->npoints == zio->points_size)
+    {
+      size_t size = zio->points_size == 0 ? 16 : zio->points_size * 2;
+      struct ios_dev_zlib_point *points
+        = realloc (zio->points, size * sizeof (struct ios_dev_zlib_point));
+
+      if (!points)
+        return IOD_ERROR;
+      zio->points = points;
+      zio->points_size = size;
+    }
+
+  point = &zio->points[zio->npoints];
+  point->out = zio->out;
+  point->in = in;
+  point->bits = member_p ? 0 : zio->strm.data_type & 7;
+  point->window = NULL;
+
+  if (!member_p)
+    {
+      point->window = malloc (ZLIB_WINSIZE);
+      if (!point->window)
+        return IOD_ERROR;
+
+      /* Store the history in order.  */
+      memcpy (point->window, zio->window + zio->wpos,
+              ZLIB_WINSIZE - zio->wpos);
+      memcpy (point->window + ZLIB_WINSIZE - zio->wpos, zio->window,
+              zio->wpos);
+    }
+
+  zio->npoints++;
+  return 0;
+}
+
+/* Resume decompression in ZIO at POINT.  Return 0 on success,
+   IOD_ERROR otherwise.  */
+
+static int
+ios_dev_zlib_resume (struct ios_dev_zlib *zio,
+                     struct ios_dev_zlib_point *point)
+{
+  off_t in = point->in - (point->bits ? 1 : 0);
+
+  if (lseek (zio->fd, in, SEEK_SET) == -1)
+    return IOD_ERROR;
+
+  zio->strm.avail_in = 0;
+  zio->strm.next_in = zio->inbuf;
+  zio->raw_p = (point->window != NULL);
+  zio->skip = 0;
+  zio->member_p = !zio->raw_p;
+  zio->out = point->out;
+  zio->eof_p = false;
+
+  if (inflateReset2 (&zio->strm, zio->raw_p ? -15 : 31) != Z_OK)
+    return IOD_ERROR;
+
+  if (zio->raw_p)
+    {
+      if (point->bits)
+        {
+          uint8_t c;
+
+          if (read (zio->fd, &c, 1) != 1
+              || inflatePrime (&zio->strm, point->bits,
+                               c >> (8 - point->bits)) != Z_OK)
+            return IOD_ERROR;
+        }
+
+      if (inflateSetDictionary (&zio->strm, point->window,
+                                ZLIB_WINSIZE) != Z_OK)
+        return IOD_ERROR;
+
+      memcpy (zio->window, point->window, ZLIB_WINSIZE);
+      zio->wpos = 0;
+    }
+
+  return 0;
+}
+
+/* Decompress up to COUNT bytes from ZIO, storing them in BUF unless
+   it is NULL.  If INDEX_P is set, add checkpoints as the data is
+   decompressed.  Return the number of bytes produced, which is less
+   than COUNT only at the end of the data, or -1 on error.  */
+
+static int64_t
+ios_dev_zlib_inflate (struct ios_dev_zlib *zio, uint8_t *buf,
+                      uint64_t count, bool index_p)
+{
+  z_stream *strm = &zio->strm;
+  ios_dev_off last
+    = zio->npoints > 0 ? zio->points[zio->npoints - 1].out : 0;
+  uint64_t produced = 0;
+
+  while (produced < count && !zio->eof_p)
+    {
+      size_t want, got;
+      int ret;
+
+      if (strm->avail_in == 0)
+        {
+          ssize_t nread = read (zio->fd, zio->inbuf, ZLIB_CHUNK);
+
+          if (nread == -1)
+            {
+              if (errno == EINTR)
+                continue;
+              return -1;
+            }
+          if (nread == 0)
+            {
+              /* Truncated members are an error.  */
+              if (!zio->member_p || zio->skip > 0)
+                return -1;
+              zio->eof_p = true;
+              break;
+            }
+
+          strm->next_in = zio->inbuf;
+          strm->avail_in = nread;
+        }
+
+      /* Skip the trailer of a member decompressed in raw mode.  */
+      if (zio->skip > 0)
+        {
+          size_t n = zio->skip < strm->avail_in ? zio->skip : strm->avail_in;
+
+          strm->next_in += n;
+          strm->avail_in -= n;
+          zio->skip -= n;
+          continue;
+        }
+
+      want = ZLIB_WINSIZE - zio->wpos;
+      if (want > count - produced)
+        want = count - produced;
+
+      strm->next_out = zio->window + zio->wpos;
+      strm->avail_out = want;
+      ret = inflate (strm, index_p ? Z_BLOCK : Z_NO_FLUSH);
+      got = want - strm->avail_out;
+
+      if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR)
+        {
+          /* Some gzip files are padded with garbage after the last
+             member.  Ignore it.  */
+          if (zio->member_p && zio->out > 0)
+            {
+              zio->eof_p = true;
+              break;
+            }
+          return -1;
+        }
+
+      if (got > 0)
+        {
+          if (buf != NULL)
+            memcpy (buf + produced, zio->window + zio->wpos, got);
+          zio->wpos = (zio->wpos + got) % ZLIB_WINSIZE;
+          zio->out += got;
+          produced += got;
+          zio->member_p = false;
+        }
+
+      if (ret == Z_STREAM_END)
+        {
+          /* Go on with the next member, if any.  In raw mode, the
+             8-byte trailer of the member is not consumed by
+             inflate.  */
+          if (zio->raw_p)
+            zio->skip = 8;
+          if (inflateReset2 (strm, 31) != Z_OK)
+            return -1;
+          zio->raw_p = false;
+          zio->member_p = true;
+
+          if (index_p)
+            {
+              if (ios_dev_zlib_add_point (zio, true,
+                                          lseek (zio->fd, 0, SEEK_CUR)
+                                          - strm->avail_in) != 0)
+                return -1;
+              last = zio->out;
+            }
+          continue;
+        }
+
+      /* Add a checkpoint if we are at a block boundary far enough
+         from the previous checkpoint.  */
+      if (index_p
+          && (strm->data_type & 128) && !(strm->data_type & 64)
+          && zio->out - last > ZLIB_SPAN)
+        {
+          if (ios_dev_zlib_add_point (zio, false,
+                                      lseek (zio->fd, 0, SEEK_CUR)
+                                      - strm->avail_in) != 0)
+            return -1;
+          last = zio->out;
+        }
+    }
+
+  return produced;
+}
+
+static void *
+ios_dev_zlib_open (const char *handler, uint64_t flags, int *error)
+{
+  struct ios_dev_zlib *zio = NULL;
+  const char *filename = handler + strlen (ZLIB_PREFIX);
+  uint8_t flags_mode = flags & IOS_FLAGS_MODE;
+  int err = IOD_ERROR;
+  int64_t size;
+
+  /* Compressed files can only be read.  */
+  if (flags_mode != 0 && flags_mode != IOS_F_READ)
+    {
+      err = IOD_EINVAL;
+      goto err;
+    }
+
+  zio = calloc (1, sizeof (struct ios_dev_zlib));
+  if (!zio)
+    goto err;
+  zio->fd = -1;
+
+  zio->filename = strdup (filename);
+  if (!zio->filename)
+    goto err;
+
+  zio->fd = open (filename, O_RDONLY);
+  if (zio->fd == -1)
+    goto err;
+
+  if (inflateInit2 (&zio->strm, 31) != Z_OK)
+    goto err;
+
+  /* Decompress the whole file, building the index.  The first
+     checkpoint is the beginning of the first member.  */
+  zio->flags = IOS_F_READ;
+  if (ios_dev_zlib_add_point (zio, true, 0) != 0)
+    goto err_inflate;
+
+  size = ios_dev_zlib_inflate (zio, NULL, (uint64_t) -1, true);
+  if (size == -1)
+    goto err_inflate;
+
+  /* The last checkpoint may be at the end of the data.  */
+  while (zio->npoints > 1
+         && zio->points[zio->npoints - 1].out == (ios_dev_off) size)
+    free (zio->points[--zio->npoints].window);
+
+  zio->size = size;
+  return zio;
+
+ err_inflate:
+  inflateEnd (&zio->strm);
+ err:
+  if (zio)
+    {
+      size_t i;
+
+      for (i = 0; i < zio->npoints; ++i)
+        free (zio->points[i].window);
+      free (zio->points);
+      if (zio->fd != -1)
+        close (zio->fd);
+      free (zio->filename);
+      free (zio);
+    }
+
+  if (error != NULL)
+    *error = err;
+
+  return NULL;
+}
+
+static int
+ios_dev_zlib_close (void *iod)
+{
+  struct ios_dev_zlib *zio = iod;
+  size_t i;
+
+  inflateEnd (&zio->strm);
+  for (i = 0; i < zio->npoints; ++i)
+    free (zio->points[i].window);
+  free (zio->points);
+  close (zio->fd);
+  free (zio->filename);
+  free (zio);
+
+  return 1;
+}
+
+static uint64_t
+ios_dev_zlib_get_flags (void *iod)
+{
+  struct ios_dev_zlib *zio = iod;
+
+  return zio->flags;
+}
+
+static int
+ios_dev_zlib_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_zlib *zio = iod;
+  uint64_t skip;
+
+  if (offset > zio->size || count > zio->size - offset)
+    return IOD_EOF;
+
+  /* Resume at the closest checkpoint before OFFSET, unless going on
+     from the current position is cheaper.  */
+  if (offset < zio->out || offset - zio->out > ZLIB_SPAN)
+    {
+      size_t lo = 0, hi = zio->npoints;
+
+      while (hi - lo > 1)
+        {
+          size_t mid = lo + (hi - lo) / 2;
+
+          if (zio->points[mid].out <= offset)
+            lo = mid;
+          else
+            hi = mid;
+        }
+
+      if (ios_dev_zlib_resume (zio, &zio->points[lo]) != 0)
+        return IOD_ERROR;
+    }
+
+  skip = offset - zio->out;
+  if (ios_dev_zlib_inflate (zio, NULL, skip, false) != (int64_t) skip
+      || ios_dev_zlib_inflate (zio, buf, count, false) != (int64_t) count)
+    {
+      /* Force resuming at a checkpoint in the next read.  */
+      zio->out = (ios_dev_off) -1;
+      return IOD_ERROR;
+    }
+
+  return 0;
+}
+
+static int
+ios_dev_zlib_pwrite (void *iod, const void *buf, size_t count,
+                     ios_dev_off offset)
+{
+  return IOD_ERROR;
+}
+
+static ios_dev_off
+ios_dev_zlib_size (void *iod)
+{
+  struct ios_dev_zlib *zio = iod;
+
+  return zio->size;
+}
+
+static int
+ios_dev_zlib_flush (void *iod, ios_dev_off offset)
+{
+  return IOS_OK;
+}
+
+struct ios_dev_if ios_dev_zlib
+  __attribute__ ((visibility ("hidden"))) =
+  {
+   .handler_normalize = ios_dev_zlib_handler_normalize,
+   .open = ios_dev_zlib_open,
+   .close = ios_dev_zlib_close,
+   .pread = ios_dev_zlib_pread,
+   .pwrite = ios_dev_zlib_pwrite,
+   .get_flags = ios_dev_zlib_get_flags,
+   .size = ios_dev_zlib_size,
+   .flush = ios_dev_zlib_flush,
+  };
@@ -38,6 +38,19 @@ typedef uint64_t ios_dev_off;
 #define IOD_EOF    -2
 #define IOD_EINVAL -3 /* Invalid argument.  */
 
+/* A read request, as passed to the pread_batch operation of the
+   device interface below.  COUNT bytes at the byte OFFSET are to be
+   read into BUF.  RET is set to the status of the read, with the same
+   meaning as the value returned by pread.  */
+
+struct ios_dev_req
+{
+  void *buf;
+  size_t count;
+  ios_dev_off offset;
+  int ret;
+};
+
 /* Each IO backend should implement a device interface, by filling an
    instance of the struct defined below.  */
 
@@ -57,9 +70,9 @@ struct ios_dev_if
 
   void *(*open) (const char *handler, uint64_t flags, int *error);
 
-  /* Close the given device.  Return 0 if there was an error during
-
-     the operation, 1 otherwise.  */
+  /* Close the given device.  Return IOD_ERROR if there was an error
+     during the operation, 1 otherwise.  Note that the device is freed
+     in either case.  */
 
   int (*close) (void *dev);
 
@@ -73,6 +86,14 @@ struct ios_dev_if
 
   int (*pwrite) (void *dev, const void *buf, size_t count, ios_dev_off offset);
 
+  /* Perform the NREQS reads in REQS, which don't overlap, storing the
+     status of each of them in its RET field.  The device is free to
+     perform the reads concurrently and in any order.  This operation
+     is optional: if it is NULL, the reads are performed one after the
+     other using pread.  */
+
+  void (*pread_batch) (void *dev, struct ios_dev_req *reqs, size_t nreqs);
+
   /* Return the flags of the device, as it was opened.  */
 
   uint64_t (*get_flags) (void *dev);
@@ -86,6 +107,24 @@ struct ios_dev_if
      OFFSET.  Otherwise, do not do anything.  Return IOS_OK ın success and
      an error code on failure.  */
   int (*flush) (void *dev, ios_dev_off offset);
+
+  /* If not zero, the IO spaces operating on devices of this kind
+     access them directly, without using the IO space cache.  This is
+     useful for devices whose pread and pwrite operations are as cheap
+     as accessing the cache, like the ones backed by memory.  */
+  int nocache;
+
+  /* If not zero, the contents of devices of this kind may change at
+     any time, like the memory of a running process.  The IO spaces
+     operating on them write through their cache, and discard the
+     cached data when they are flushed.  */
+  int live;
+
+  /* If not zero, the size of devices of this kind only accounts for
+     the data read from them so far, like the ones reading from a
+     pipe.  Reading past it may succeed, until the device reaches its
+     end of file.  */
+  int stream;
 };
 
 #define IOS_FILE_HANDLER_NORMALIZE(handler, newhandler)                 \
@@ -107,3 +146,43 @@ struct ios_dev_if
         (newhandler) = NULL;                                            \
     }                                                                   \
   while (0)
+
+/* File devices (see ios-dev-file.c) provide the following additional
+   operation.
+
+   ios_dev_file_copy copies COUNT bytes from the byte offset FROM of
+   the file device FROM_DEV to the byte offset TO of the file device
+   TO_DEV, within the kernel.  The ranges shall not overlap.  Return
+   the number of bytes copied, which is less than COUNT if the system
+   can't copy the data that way, for example because the files live in
+   different file systems.  The rest of the bytes shall then be copied
+   by other means.  */
+
+size_t ios_dev_file_copy (void *from_dev, ios_dev_off from,
+                          void *to_dev, ios_dev_off to, size_t count)
+  __attribute__ ((visibility ("hidden")));
+
+/* Overlay devices (see ios-dev-overlay.c) provide the following
+   additional operations on the device DEV.
+
+   ios_dev_overlay_commit writes the data written to the overlay to
+   the base IO space, and forgets it.  Return IOS_OK on success, or an
+   IOS error code otherwise.
+
+   ios_dev_overlay_discard forgets the data written to the overlay.
+
+   ios_dev_overlay_map calls CB for every extent of data written to
+   the overlay, in increasing offset order.  OFFSET and SIZE are
+   measured in bytes.  */
+
+int ios_dev_overlay_commit (void *dev)
+  __attribute__ ((visibility ("hidden")));
+
+void ios_dev_overlay_discard (void *dev)
+  __attribute__ ((visibility ("hidden")));
+
+void ios_dev_overlay_map (void *dev,
+                          void (*cb) (ios_dev_off offset, size_t size,
+                                      void *data),
+                          void *data)
+  __attribute__ ((visibility ("hidden")));
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <limits.h>
+#include <string.h>
 #define _(str) gettext (str)
 #include <streq.h>
 
@@ -30,20 +31,20 @@
 #include "ios.h"
 #include "ios-dev.h"
 
-#define IOS_GET_C_ERR_CHCK(c, io, off)                                \
-  {                                                                \
-    uint8_t ch;                                                        \
-    int ret = (io)->dev_if->pread ((io)->dev, &ch, 1, off);         \
-    if (ret == IOD_EOF)                                                \
-      return IOS_EIOFF;                                                \
-    (c) = ch;                                                        \
+#define IOS_GET_C_ERR_CHCK(c, io, flags, off)                         \
+  {                                                                   \
+    uint8_t ch;                                                       \
+    int ret = ios_pread ((io), (flags), &ch, 1, off);                 \
+    if (ret != IOS_OK)                                                \
+      return ret;                                                     \
+    (c) = ch;                                                         \
   }
 
-#define IOS_PUT_C_ERR_CHCK(c, io, len, off)                \
-  {                                                        \
-    if ((io)->dev_if->pwrite ((io)->dev, c, len, off)      \
-        == IOD_EOF)                                        \
-      return IOS_EIOFF;                                    \
+#define IOS_PUT_C_ERR_CHCK(c, io, flags, len, off)                    \
+  {                                                                   \
+    int ret = ios_pwrite ((io), (flags), c, len, off);                \
+    if (ret != IOS_OK)                                                \
+      return ret;                                                     \
   }
 
 /* The following struct implements an instance of an IO space.
@@ -55,6 +56,19 @@
    DEV is the device operated by the IO space.
    DEV_IF is the interface to use when operating the device.
 
+   BIAS is the bias applied to every read/write operation.
+
+   CACHE is the cache of device blocks associated with the IO space.
+   It is created lazily on the first access to the space, and it is
+   NULL if the space is not cached.
+
+   HITS and MISSES count the accesses to the device blocks that were
+   served by the cache and by the device, respectively.
+
+   RA_NEXT is the byte offset right after the blocks brought to the
+   cache by the last miss.  A miss at that offset reveals a sequential
+   access pattern, and makes the IO space read ahead.
+
    NEXT is a pointer to the next open IO space, or NULL.
 
    XXX: add status, saved or not saved.
@@ -68,6 +82,11 @@ struct ios
   struct ios_dev_if *dev_if;
   ios_off bias;
 
+  struct ios_cache *cache;
+  uint64_t hits;
+  uint64_t misses;
+  ios_dev_off ra_next;
+
   struct ios *next;
 };
 
@@ -84,22 +103,651 @@ static struct ios *cur_io;
    provide the following interfaces.  */
 
 extern struct ios_dev_if ios_dev_mem; /* ios-dev-mem.c */
+extern struct ios_dev_if ios_dev_stream; /* ios-dev-stream.c */
+extern struct ios_dev_if ios_dev_overlay; /* ios-dev-overlay.c */
+extern struct ios_dev_if ios_dev_sub; /* ios-dev-sub.c */
 extern struct ios_dev_if ios_dev_file; /* ios-dev-file.c */
+#ifdef HAVE_MMAP
+extern struct ios_dev_if ios_dev_mmap; /* ios-dev-mmap.c */
+#endif
 #ifdef HAVE_LIBNBD
 extern struct ios_dev_if ios_dev_nbd; /* ios-dev-nbd.c */
 #endif
+#ifdef HAVE_ZLIB
+extern struct ios_dev_if ios_dev_zlib; /* ios-dev-zlib.c */
+#endif
+#ifdef HAVE_PROC
+extern struct ios_dev_if ios_dev_proc; /* ios-dev-proc.c */
+#endif
 
 static struct ios_dev_if *ios_dev_ifs[] =
   {
    &ios_dev_mem,
+#ifdef HAVE_MMAP
+   &ios_dev_mmap,
+#endif
 #ifdef HAVE_LIBNBD
    &ios_dev_nbd,
 #endif
+#ifdef HAVE_ZLIB
+   &ios_dev_zlib,
+#endif
+#ifdef HAVE_PROC
+   &ios_dev_proc,
+#endif
+   &ios_dev_stream,
+   &ios_dev_overlay,
+   &ios_dev_sub,
    /* File must be last */
    &ios_dev_file,
    NULL,
   };
 
+/* IO space cache.
+
+   Every IO space operates on its device through a cache of fixed-size
+   blocks of device bytes.  Blocks are always aligned to the block
+   size, which is a power of two.  The cache is organized as a hash
+   table indexed by block number, and the blocks are kept in a list
+   sorted by recency of use, which is used to evict the least recently
+   used block when the cache is full.
+
+   The cache is write-back: writes to cached blocks are performed in
+   the cache and the modified range of bytes is recorded in the block.
+   Modified blocks are written back to the device when they are
+   evicted, and also by ios_flush and ios_close.
+
+   Writes to blocks that are not in the cache go directly to the
+   device, i.e. no block is allocated in the cache because of a
+   write.  This is because some devices (like files opened in
+   write-only mode) do not support reading.  Note that the
+   read-modify-write sequences performed when writing integers not
+   aligned to byte boundaries will in any case bring the block to the
+   cache.
+
+   OFFSET is the byte offset of the block in the device.
+
+   VALID is the number of bytes in DATA that contain device data.  It
+   is smaller than the block size only for the last block of the
+   device.
+
+   DIRTY_BEG and DIRTY_END delimit the range of bytes in DATA that have
+   been modified since the block was read from the device.  The range
+   is empty if both are equal.
+
+   HNEXT links the blocks in the same hash bucket.
+
+   PREV and NEXT link the blocks in the recency list.  */
+
+struct ios_cache_block
+{
+  ios_dev_off offset;
+  size_t valid;
+  size_t dirty_beg;
+  size_t dirty_end;
+  uint8_t *data;
+
+  struct ios_cache_block *hnext;
+  struct ios_cache_block *prev;
+  struct ios_cache_block *next;
+};
+
+/* BLOCK_SIZE is the size of every block in the cache, in bytes.
+
+   NBLOCKS is the number of blocks in BLOCKS.  DATA is the storage for
+   the contents of the blocks.
+
+   FREE is a list of unused blocks, linked by HNEXT.
+
+   BUCKETS is the hash table, with NBUCKETS entries.  NBUCKETS is a
+   power of two.
+
+   MRU and LRU are the most and least recently used blocks in the
+   cache, respectively.  */
+
+struct ios_cache
+{
+  size_t block_size;
+  size_t nblocks;
+  struct ios_cache_block *blocks;
+  uint8_t *data;
+
+  struct ios_cache_block *free;
+
+  size_t nbuckets;
+  struct ios_cache_block **buckets;
+
+  struct ios_cache_block *mru;
+  struct ios_cache_block *lru;
+};
+
+/* Size of the cache associated with each IO space, and size of the
+   cache blocks.  Both are in bytes.  */
+
+static uint64_t ios_cache_size_setting = IOS_CACHE_DEFAULT_SIZE;
+static uint64_t ios_cache_block_size_setting = IOS_CACHE_DEFAULT_BLOCK_SIZE;
+
+/* Convert a status code returned by an IOD into a status code of the
+   IOS API.  */
+
+static inline int
+ios_dev_status (int ret)
+{
+  if (ret == 0)
+    return IOS_OK;
+  else if (ret == IOD_EOF)
+    return IOS_EIOFF;
+  else
+    return IOS_ERROR;
+}
+
+static struct ios_cache *
+ios_cache_new (void)
+{
+  struct ios_cache *cache;
+  size_t block_size = ios_cache_block_size_setting;
+  size_t nblocks = ios_cache_size_setting / block_size;
+  size_t i;
+
+  if (nblocks == 0)
+    return NULL;
+
+  cache = calloc (1, sizeof (struct ios_cache));
+  if (!cache)
+    return NULL;
+
+  cache->block_size = block_size;
+  cache->nblocks = nblocks;
+  for (cache->nbuckets = 1; cache->nbuckets < nblocks; cache->nbuckets <<= 1)
+    ;
+
+  cache->blocks = calloc (nblocks, sizeof (struct ios_cache_block));
+  cache->buckets = calloc (cache->nbuckets, sizeof (struct ios_cache_block *));
+  cache->data = malloc (nblocks * block_size);
+  if (!cache->blocks || !cache->buckets || !cache->data)
+    {
+      free (cache->blocks);
+      free (cache->buckets);
+      free (cache->data);
+      free (cache);
+      return NULL;
+    }
+
+  for (i = 0; i < nblocks; ++i)
+    {
+      cache->blocks[i].data = cache->data + i * block_size;
+      cache->blocks[i].hnext = cache->free;
+      cache->free = &cache->blocks[i];
+    }
+
+  return cache;
+}
+
+static inline struct ios_cache_block **
+ios_cache_bucket (struct ios_cache *cache, ios_dev_off offset)
+{
+  return &cache->buckets[(offset / cache->block_size)
+                         & (cache->nbuckets - 1)];
+}
+
+/* Return the block in CACHE starting at the given byte OFFSET, or
+   NULL if the block is not in the cache.  */
+
+static inline struct ios_cache_block *
+ios_cache_lookup (struct ios_cache *cache, ios_dev_off offset)
+{
+  struct ios_cache_block *block;
+
+  /* Accesses tend to be local, so check the most recently used block
+     first.  */
+  if (cache->mru && cache->mru->offset == offset)
+    return cache->mru;
+
+  for (block = *ios_cache_bucket (cache, offset);
+       block;
+       block = block->hnext)
+    if (block->offset == offset)
+      break;
+
+  return block;
+}
+
+/* Make BLOCK the most recently used block in CACHE.  */
+
+static inline void
+ios_cache_touch (struct ios_cache *cache, struct ios_cache_block *block)
+{
+  if (cache->mru == block)
+    return;
+
+  /* Unlink the block from the recency list... */
+  if (block->prev)
+    block->prev->next = block->next;
+  if (block->next)
+    block->next->prev = block->prev;
+  if (cache->lru == block)
+    cache->lru = block->prev;
+
+  /* ... and put it in front of it.  */
+  block->prev = NULL;
+  block->next = cache->mru;
+  if (cache->mru)
+    cache->mru->prev = block;
+  cache->mru = block;
+  if (cache->lru == NULL)
+    cache->lru = block;
+}
+
+/* Write the modified contents of BLOCK back to the device operated
+   by IO.  */
+
+static int
+ios_cache_writeback (ios io, struct ios_cache_block *block)
+{
+  int ret;
+
+  if (block->dirty_beg == block->dirty_end)
+    return IOS_OK;
+
+  ret = io->dev_if->pwrite (io->dev,
+                            block->data + block->dirty_beg,
+                            block->dirty_end - block->dirty_beg,
+                            block->offset + block->dirty_beg);
+  if (ret != 0)
+    return ios_dev_status (ret);
+
+  block->dirty_beg = block->dirty_end = 0;
+  return IOS_OK;
+}
+
+/* Remove BLOCK from the cache of IO, writing it back to the device
+   first if needed.  */
+
+static int
+ios_cache_evict (ios io, struct ios_cache_block *block)
+{
+  struct ios_cache *cache = io->cache;
+  struct ios_cache_block **b;
+  int ret;
+
+  if ((ret = ios_cache_writeback (io, block)) != IOS_OK)
+    return ret;
+
+  for (b = ios_cache_bucket (cache, block->offset); *b != block;
+       b = &(*b)->hnext)
+    ;
+  *b = block->hnext;
+
+  if (block->prev)
+    block->prev->next = block->next;
+  else
+    cache->mru = block->next;
+  if (block->next)
+    block->next->prev = block->prev;
+  else
+    cache->lru = block->prev;
+
+  block->prev = block->next = NULL;
+  block->hnext = cache->free;
+  cache->free = block;
+
+  return IOS_OK;
+}
+
+/* Write back all the modified blocks in the cache of IO.  */
+
+static int
+ios_cache_sync (ios io)
+{
+  struct ios_cache_block *block;
+  int ret = IOS_OK;
+
+  if (io->cache == NULL)
+    return IOS_OK;
+
+  for (block = io->cache->mru; block; block = block->next)
+    {
+      int r = ios_cache_writeback (io, block);
+
+      if (r != IOS_OK)
+        ret = r;
+    }
+
+  return ret;
+}
+
+/* Write back and remove from the cache of IO every block overlapping
+   the COUNT bytes starting at the byte OFFSET.  This is used before
+   accessing the device directly.  */
+
+static int
+ios_cache_invalidate (ios io, ios_dev_off offset, size_t count)
+{
+  struct ios_cache *cache = io->cache;
+  ios_dev_off boff;
+  int ret;
+
+  if (cache == NULL || count == 0)
+    return IOS_OK;
+
+  for (boff = offset & ~((ios_dev_off) cache->block_size - 1);
+       boff < offset + count;
+       boff += cache->block_size)
+    {
+      struct ios_cache_block *block = ios_cache_lookup (cache, boff);
+
+      if (block && (ret = ios_cache_evict (io, block)) != IOS_OK)
+        return ret;
+    }
+
+  return IOS_OK;
+}
+
+/* Write back and free the cache associated with IO.  */
+
+static int
+ios_cache_drop (ios io)
+{
+  int ret = ios_cache_sync (io);
+
+  if (io->cache)
+    {
+      free (io->cache->blocks);
+      free (io->cache->buckets);
+      free (io->cache->data);
+      free (io->cache);
+      io->cache = NULL;
+    }
+
+  return ret;
+}
+
+/* Perform the NREQS reads in REQS on the device operated by IO,
+   using its pread_batch operation if it provides one.  */
+
+static void
+ios_dev_pread_batch (ios io, struct ios_dev_req *reqs, size_t nreqs)
+{
+  size_t i;
+
+  if (io->dev_if->pread_batch && nreqs > 1)
+    {
+      io->dev_if->pread_batch (io->dev, reqs, nreqs);
+      return;
+    }
+
+  for (i = 0; i < nreqs; ++i)
+    reqs[i].ret = io->dev_if->pread (io->dev, reqs[i].buf, reqs[i].count,
+                                     reqs[i].offset);
+}
+
+/* Maximum number of blocks brought into a cache in a single batch of
+   reads.  */
+
+#define IOS_CACHE_BATCH_MAX 64
+
+/* Return the maximum number of blocks brought into CACHE in a single
+   batch, which is never more than half of the cache, so the blocks
+   read don't evict each other.  */
+
+static inline size_t
+ios_cache_batch_max (struct ios_cache *cache)
+{
+  size_t max = cache->nblocks / 2;
+
+  if (max > IOS_CACHE_BATCH_MAX)
+    return IOS_CACHE_BATCH_MAX;
+  return max == 0 ? 1 : max;
+}
+
+/* Bring the blocks of the device that overlap the COUNT bytes
+   starting at the byte OFFSET into the cache of IO, evicting the
+   least recently used blocks if necessary.  OFFSET shall be aligned
+   to the block size.
+
+   The blocks that are not in the cache are read from the device in a
+   single batch, of at most ios_cache_batch_max blocks.  Return the
+   block starting at OFFSET, or NULL if it couldn't be read from the
+   device.  */
+
+static struct ios_cache_block *
+ios_cache_fill (ios io, ios_dev_off offset, size_t count)
+{
+  struct ios_cache *cache = io->cache;
+  struct ios_dev_req reqs[IOS_CACHE_BATCH_MAX];
+  struct ios_cache_block *blocks[IOS_CACHE_BATCH_MAX];
+  ios_dev_off dev_size = io->dev_if->size (io->dev);
+  ios_dev_off end, boff;
+  size_t i, max = ios_cache_batch_max (cache), nreqs = 0;
+
+  if (offset >= dev_size || count == 0)
+    return NULL;
+  end = count > dev_size - offset ? dev_size : offset + count;
+
+  for (boff = offset; boff < end && nreqs < max; boff += cache->block_size)
+    {
+      struct ios_cache_block *block;
+      size_t valid;
+
+      if (ios_cache_lookup (cache, boff))
+        continue;
+
+      if (cache->free == NULL
+          && (cache->lru == NULL
+              || ios_cache_evict (io, cache->lru) != IOS_OK))
+        break;
+
+      block = cache->free;
+      cache->free = block->hnext;
+
+      valid = dev_size - boff;
+      if (valid > cache->block_size)
+        valid = cache->block_size;
+
+      blocks[nreqs] = block;
+      reqs[nreqs].buf = block->data;
+      reqs[nreqs].count = valid;
+      reqs[nreqs].offset = boff;
+      nreqs++;
+    }
+
+  ios_dev_pread_batch (io, reqs, nreqs);
+
+  /* Insert the blocks in reverse order, so the block at OFFSET ends
+     up being the most recently used one.  */
+  for (i = nreqs; i-- > 0;)
+    {
+      struct ios_cache_block *block = blocks[i];
+      struct ios_cache_block **bucket;
+
+      if (reqs[i].ret != 0)
+        {
+          block->hnext = cache->free;
+          cache->free = block;
+          continue;
+        }
+
+      block->offset = reqs[i].offset;
+      block->valid = reqs[i].count;
+      block->dirty_beg = block->dirty_end = 0;
+
+      bucket = ios_cache_bucket (cache, block->offset);
+      block->hnext = *bucket;
+      *bucket = block;
+
+      block->prev = block->next = NULL;
+      ios_cache_touch (cache, block);
+    }
+
+  return ios_cache_lookup (cache, offset);
+}
+
+/* Return whether accesses to IO shall go through the cache, creating
+   it if needed.  */
+
+static inline int
+ios_cache_p (ios io, int flags)
+{
+  if ((flags & IOS_F_BYPASS_CACHE) || io->dev_if->nocache)
+    return 0;
+
+  if (io->cache == NULL)
+    io->cache = ios_cache_new ();
+
+  return io->cache != NULL;
+}
+
+/* Read COUNT bytes from the device operated by IO, starting at the
+   byte OFFSET, and put them in BUF.  */
+
+static int
+ios_pread (ios io, int flags, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_cache *cache;
+  uint8_t *p = buf;
+  int ret;
+
+  if (!ios_cache_p (io, flags))
+    goto direct;
+
+  cache = io->cache;
+  while (count > 0)
+    {
+      ios_dev_off boff = offset & ~((ios_dev_off) cache->block_size - 1);
+      size_t start = offset - boff;
+      size_t n = cache->block_size - start;
+      struct ios_cache_block *block;
+
+      if (n > count)
+        n = count;
+
+      block = ios_cache_lookup (cache, boff);
+      if (block)
+        io->hits++;
+      else
+        {
+          /* Bring the rest of the requested blocks along with this
+             one, and read ahead if the access is sequential.  */
+          size_t fill = start + count;
+          size_t ra = ios_cache_batch_max (cache) * cache->block_size;
+
+          if (boff == io->ra_next && fill < ra)
+            fill = ra;
+
+          io->misses++;
+          block = ios_cache_fill (io, boff, fill);
+          if (fill > ra)
+            fill = ra;
+          io->ra_next = boff + (fill + cache->block_size - 1)
+                               / cache->block_size * cache->block_size;
+        }
+
+      /* If the data is not available in the cache, let the device
+         decide what to do with the request.  */
+      if (block == NULL || start + n > block->valid)
+        goto direct;
+
+      ios_cache_touch (cache, block);
+      memcpy (p, block->data + start, n);
+
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
+  return IOS_OK;
+
+ direct:
+  if ((ret = ios_cache_invalidate (io, offset, count)) != IOS_OK)
+    return ret;
+  return ios_dev_status (io->dev_if->pread (io->dev, p, count, offset));
+}
+
+/* Write COUNT bytes from BUF to the device operated by IO, starting
+   at the byte OFFSET.  */
+
+static int
+ios_pwrite (ios io, int flags, const void *buf, size_t count,
+            ios_dev_off offset)
+{
+  struct ios_cache *cache;
+  const uint8_t *p = buf;
+  int ret;
+
+  if (!ios_cache_p (io, flags))
+    {
+      if ((ret = ios_cache_invalidate (io, offset, count)) != IOS_OK)
+        return ret;
+      return ios_dev_status (io->dev_if->pwrite (io->dev, buf, count,
+                                                 offset));
+    }
+
+  cache = io->cache;
+  while (count > 0)
+    {
+      ios_dev_off boff = offset & ~((ios_dev_off) cache->block_size - 1);
+      size_t start = offset - boff;
+      size_t n = cache->block_size - start;
+      struct ios_cache_block *block;
+
+      if (n > count)
+        n = count;
+
+      block = ios_cache_lookup (cache, boff);
+      if (block && start + n <= block->valid)
+        {
+          io->hits++;
+          ios_cache_touch (cache, block);
+
+          /* Writes to live devices are not deferred.  */
+          if (io->dev_if->live)
+            {
+              ret = ios_dev_status (io->dev_if->pwrite (io->dev, p, n,
+                                                        offset));
+              if (ret != IOS_OK)
+                return ret;
+              memcpy (block->data + start, p, n);
+            }
+          else
+            {
+              memcpy (block->data + start, p, n);
+
+              if (block->dirty_beg == block->dirty_end)
+                {
+                  block->dirty_beg = start;
+                  block->dirty_end = start + n;
+                }
+              else
+                {
+                  if (start < block->dirty_beg)
+                    block->dirty_beg = start;
+                  if (start + n > block->dirty_end)
+                    block->dirty_end = start + n;
+                }
+            }
+        }
+      else
+        {
+          /* Writes that are not fully contained in a cached block
+             go directly to the device, since they may change its
+             size.  */
+          io->misses++;
+          if (block && (ret = ios_cache_evict (io, block)) != IOS_OK)
+            return ret;
+          if ((ret = ios_dev_status (io->dev_if->pwrite (io->dev, p, n,
+                                                         offset)))
+              != IOS_OK)
+            return ret;
+        }
+
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
+  return IOS_OK;
+}
+
 void
 ios_init (void)
 {
@@ -129,6 +777,10 @@ ios_open (const char *handler, uint64_t flags, int set_cur)
   io->id = ios_next_id++;
   io->next = NULL;
   io->bias = 0;
+  io->cache = NULL;
+  io->hits = 0;
+  io->misses = 0;
+  io->ra_next = (ios_dev_off) -1;
 
   /* Look for a device interface suitable to operate on the given
      handler.  */
@@ -172,18 +824,21 @@ ios_open (const char *handler, uint64_t flags, int set_cur)
   return ret;
 }
 
-void
+int
 ios_close (ios io)
 {
   struct ios *tmp;
-  int r;
+  int ret;
 
   /* XXX: if not saved, ask before closing.  */
 
-  /* Close the device operated by the IO space.
-     XXX: handle errors.  */
-  r = io->dev_if->close (io->dev);
-  assert (r);
+  /* Write back the modified contents of the cache.  Note that the IO
+     space is closed even if this fails.  */
+  ret = ios_cache_drop (io);
+
+  /* Close the device operated by the IO space.  */
+  if (io->dev_if->close (io->dev) == IOD_ERROR)
+    ret = IOS_ERROR;
 
   /* Unlink the IOS from the list.  */
   assert (io_list != NULL); /* The list must contain at least one IO
@@ -202,6 +857,7 @@ ios_close (ios io)
     cur_io = io_list;
 
   free (io);
+  return ret;
 }
 
 uint64_t
@@ -326,8 +982,10 @@ ios_read_int_common (ios io, ios_off offset, int flags,
   lastbyte_bits = lastbyte_bits == 0 ? 8 : lastbyte_bits;
 
   /* Read the bytes and clear the unused bits.  */
-  if (io->dev_if->pread (io->dev, c, bytes_minus1 + 1, offset / 8) == IOD_EOF)
-    return IOS_EIOFF;
+  int ret = ios_pread (io, flags, c, bytes_minus1 + 1, offset / 8);
+
+  if (ret != IOS_OK)
+    return ret;
   IOS_CHAR_GET_LSB(&c[0], firstbyte_bits);
 
   switch (bytes_minus1)
@@ -669,22 +1327,22 @@ ios_read_int_common (ios io, ios_off offset, int flags,
   }
 }
 
-int
-ios_read_int (ios io, ios_off offset, int flags,
-              int bits,
-              enum ios_endian endian,
-              enum ios_nenc nenc,
-              int64_t *value)
-{
-  /* Apply the IOS bias.  */
-  offset += ios_get_bias (io);
+/* Read a signed integer encoded in two's complement.  */
 
+static int
+ios_read_int_2c (ios io, ios_off offset, int flags,
+                 int bits,
+                 enum ios_endian endian,
+                 int64_t *value)
+{
   /* Fast track for byte-aligned 8x bits  */
   if (offset % 8 == 0 && bits % 8 == 0)
     {
       uint8_t c[8];
-      if (io->dev_if->pread (io->dev, c, bits / 8, offset / 8) == IOD_EOF)
-        return IOS_EIOFF;
+      int ret = ios_pread (io, flags, c, bits / 8, offset / 8);
+
+      if (ret != IOS_OK)
+        return ret;
 
       switch (bits) {
       case 8:
@@ -794,6 +1452,30 @@ ios_read_int (ios io, ios_off offset, int flags,
   return ret_val;
 }
 
+int
+ios_read_int (ios io, ios_off offset, int flags,
+              int bits,
+              enum ios_endian endian,
+              enum ios_nenc nenc,
+              int64_t *value)
+{
+  int ret;
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  ret = ios_read_int_2c (io, offset, flags, bits, endian, value);
+  if (ret != IOS_OK)
+    return ret;
+
+  /* In one's complement negative numbers are one less than in two's
+     complement, and the all-ones pattern is a negative zero.  */
+  if (nenc == IOS_NENC_1 && *value < 0)
+    *value += 1;
+
+  return IOS_OK;
+}
+
 int
 ios_read_uint (ios io, ios_off offset, int flags,
                int bits,
@@ -807,8 +1489,10 @@ ios_read_uint (ios io, ios_off offset, int flags,
   if (offset % 8 == 0 && bits % 8 == 0)
     {
       uint8_t c[8];
-      if (io->dev_if->pread (io->dev, c, bits / 8, offset / 8) == IOD_EOF)
-        return IOS_EIOFF;
+      int ret = ios_pread (io, flags, c, bits / 8, offset / 8);
+
+      if (ret != IOS_OK)
+        return ret;
 
       switch (bits) {
       case 8:
@@ -886,76 +1570,247 @@ ios_read_uint (ios io, ios_off offset, int flags,
   return ios_read_int_common (io, offset, flags, bits, endian, value);
 }
 
-static int realloc_string (char **str, size_t newsize)
+/* Number of bytes processed at a time when reading or writing bytes
+   at offsets that are not aligned to a byte boundary, and when
+   reading several integers at once.  */
+
+#define IOS_BYTES_CHUNK 512
+
+/* Number of bytes prefetched at a time when reading several integers
+   at once.  */
+
+#define IOS_PREFETCH_SIZE (256 * 1024)
+
+/* Store VALUE as the element with index I of the array VALUES, whose
+   elements are WIDTH bytes wide.  */
+
+static inline void
+ios_store_uint (void *values, size_t i, int width, uint64_t value)
 {
-  char *newstr = realloc (*str, newsize);
+  switch (width)
+    {
+    case 1: ((uint8_t *) values)[i] = value; break;
+    case 2: ((uint16_t *) values)[i] = value; break;
+    case 4: ((uint32_t *) values)[i] = value; break;
+    default: ((uint64_t *) values)[i] = value; break;
+    }
+}
 
-  if (!newstr)
-    return IOS_ENOMEM;
+int
+ios_read_uints (ios io, ios_off offset, int flags,
+                int bits,
+                enum ios_endian endian,
+                size_t count, int width, void *values)
+{
+  uint8_t chunk[IOS_BYTES_CHUNK];
+  size_t i, nbytes = bits / 8;
+  ios_off prefetched = offset;
+  int ret;
+
+  /* Integers whose size is not a multiple of a byte are read one at
+     a time.  */
+  if (bits % 8 != 0)
+    {
+      for (i = 0; i < count; ++i)
+        {
+          uint64_t value;
+
+          if ((ret = ios_read_uint (io, offset, flags, bits, endian,
+                                    &value)) != IOS_OK)
+            return ret;
+          ios_store_uint (values, i, width, value);
+          offset += bits;
+        }
+
+      return IOS_OK;
+    }
+
+  /* Otherwise read the integers in chunks of bytes, and decode them.
+     The bytes are brought to the cache in bigger batches ahead of
+     the chunks, so the device can serve many reads at once.  */
+  while (count > 0)
+    {
+      size_t n = IOS_BYTES_CHUNK / nbytes;
+
+      if (n > count)
+        n = count;
+
+      if (offset + n * bits > prefetched)
+        {
+          uint64_t nprefetch = (uint64_t) count * nbytes;
+
+          if (nprefetch > IOS_PREFETCH_SIZE)
+            nprefetch = IOS_PREFETCH_SIZE;
+          ios_prefetch (io, offset, flags, nprefetch);
+          prefetched = offset + nprefetch * 8;
+        }
+
+      if ((ret = ios_read_bytes (io, offset, flags, n * nbytes,
+                                 chunk)) != IOS_OK)
+        return ret;
+
+      for (i = 0; i < n; ++i)
+        {
+          const uint8_t *c = chunk + i * nbytes;
+          uint64_t value = 0;
+          size_t j;
+
+          if (endian == IOS_ENDIAN_LSB)
+            for (j = nbytes; j > 0; --j)
+              value = (value << 8) | c[j - 1];
+          else
+            for (j = 0; j < nbytes; ++j)
+              value = (value << 8) | c[j];
+
+          ios_store_uint (values, i, width, value);
+        }
+
+      values = (uint8_t *) values + n * width;
+      offset += n * bits;
+      count -= n;
+    }
 
-  *str = newstr;
   return IOS_OK;
 }
 
 int
-ios_read_string (ios io, ios_off offset, int flags, char **value)
+ios_read_uints_upto (ios io, ios_off offset, int flags,
+                     int bits,
+                     enum ios_endian endian,
+                     size_t count, int width, void *values,
+                     size_t *nread)
 {
-  char *str = NULL;
-  size_t i = 0;
+  size_t i;
   int ret;
 
+  /* Most of the times all the integers are there.  */
+  ret = ios_read_uints (io, offset, flags, bits, endian,
+                        count, width, values);
+  if (ret != IOS_EIOFF)
+    {
+      *nread = ret == IOS_OK ? count : 0;
+      return ret;
+    }
+
+  /* Otherwise read them one at a time until the end of the IO
+     space.  */
+  for (i = 0; i < count; ++i)
+    {
+      uint64_t value;
+
+      ret = ios_read_uint (io, offset, flags, bits, endian, &value);
+      if (ret == IOS_EIOFF)
+        break;
+      if (ret != IOS_OK)
+        return ret;
+
+      ios_store_uint (values, i, width, value);
+      offset += bits;
+    }
+
+  *nread = i;
+  return IOS_OK;
+}
+
+int
+ios_read_bytes (ios io, ios_off offset, int flags,
+                size_t count, void *buf)
+{
+  uint8_t *p = buf;
+  uint8_t chunk[IOS_BYTES_CHUNK + 1];
+  int shift;
+
   /* Apply the IOS bias.  */
   offset += ios_get_bias (io);
 
+  /* Fast track for byte-aligned offsets: just read the bytes from
+     the IOD.  */
   if (offset % 8 == 0)
+    return count == 0 ? IOS_OK : ios_pread (io, flags, buf, count,
+                                            offset / 8);
+
+  /* Otherwise every resulting byte is composed of the low bits of a
+     byte in the IOD and the high bits of the next one.  */
+  shift = offset % 8;
+  offset /= 8;
+  while (count > 0)
     {
-      /* This is the fast case: the string is aligned to a byte
-         boundary.  We just read bytes from the IOD until either EOF
-         or a NULL byte.  */
+      size_t i, n = count > IOS_BYTES_CHUNK ? IOS_BYTES_CHUNK : count;
+      int ret = ios_pread (io, flags, chunk, n + 1, offset);
 
-      do
-        {
-          if (i % 128 == 0)
-            {
-              if ((ret = realloc_string (&str, i + 128 * sizeof (char))) < 0)
-                goto error;
-            }
+      if (ret != IOS_OK)
+        return ret;
 
-          if (io->dev_if->pread (io->dev, &str[i], 1,
-                                 offset / 8 + i) == IOD_EOF)
-            {
-              ret = IOS_EIOFF;
-              goto error;
-            }
-        }
-      while (str[i++] != '\0');
+      for (i = 0; i < n; ++i)
+        p[i] = (chunk[i] << shift) | (chunk[i + 1] >> (8 - shift));
+
+      p += n;
+      offset += n;
+      count -= n;
     }
-  else
+
+  return IOS_OK;
+}
+
+/* Sizes of the first and the biggest chunks of bytes read at a time
+   when reading strings.  */
+
+#define IOS_STRING_CHUNK_MIN 128
+#define IOS_STRING_CHUNK_MAX 4096
+
+int
+ios_read_string (ios io, ios_off offset, int flags, char **value)
+{
+  char *str = NULL;
+  size_t len = 0, n = IOS_STRING_CHUNK_MIN;
+  /* Strings that are not aligned to a byte boundary span an extra
+     byte in the IOD.  */
+  int extra = (offset + ios_get_bias (io)) % 8 != 0;
+  int ret;
+
+  /* Read the string in chunks of increasing size, looking for the
+     terminating NULL in each of them.  Chunks are shortened so they
+     don't go past the end of the IOD, since the string may end before
+     it.  If the IOD reports no more data, read a byte at a time so it
+     can decide what to do, which is what streams need.  */
+  while (1)
     {
-      /* The string is not aligned to a byte boundary.  Instead of
-         reading bytes from the IOD, we use the IOS to read 8-byte
-         unsigned integers.  */
+      ios_dev_off boff = (offset + ios_get_bias (io)) / 8 + len;
+      ios_dev_off dev_size = io->dev_if->size (io->dev);
+      size_t count = n;
+      char *newstr;
 
-      do
+      if (dev_size <= boff + extra)
+        count = 1;
+      else if (count > dev_size - boff - extra)
+        count = dev_size - boff - extra;
+
+      if (len == IOS_STRING_MAX)
         {
-          uint64_t abyte;
+          ret = IOS_ETOOLONG;
+          goto error;
+        }
+      if (count > IOS_STRING_MAX - len)
+        count = IOS_STRING_MAX - len;
 
-          if (i % 128 == 0)
-            {
-              if ((ret = realloc_string (&str, i + 128 * sizeof (char))) < 0)
-                goto error;
-            }
+      newstr = realloc (str, len + count);
+      if (!newstr)
+        {
+          ret = IOS_ENOMEM;
+          goto error;
+        }
+      str = newstr;
 
-          ret = ios_read_uint (io, offset, flags, 8,
-                               IOS_ENDIAN_MSB, /* Arbitrary.  */
-                               &abyte);
-          if (ret == IOS_EIOFF)
-            goto error;
+      if ((ret = ios_read_bytes (io, offset + len * 8, flags, count,
+                                 str + len)) != IOS_OK)
+        goto error;
 
-          str[i] = (char) abyte;
-          offset += 8;
-        }
-      while (str[i++] != '\0');
+      if (memchr (str + len, '\0', count) != NULL)
+        break;
+
+      len += count;
+      if (n < IOS_STRING_CHUNK_MAX)
+        n *= 2;
     }
 
   *value = str;
@@ -1118,9 +1973,7 @@ ios_write_int_fast (ios io, ios_off offset, int flags,
       break;
     }
 
-  if (io->dev_if->pwrite (io->dev, c, bits / 8, offset / 8) == IOD_EOF)
-    return IOS_EIOFF;
-  return IOS_OK;
+  return ios_pwrite (io, flags, c, bits / 8, offset / 8);
 }
 
 static inline int
@@ -1148,23 +2001,23 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     {
       /* We are altering only a single byte.  */
       uint64_t head, tail;
-      IOS_GET_C_ERR_CHCK(head, io, offset / 8);
+      IOS_GET_C_ERR_CHCK(head, io, flags, offset / 8);
       tail = head;
       IOS_CHAR_GET_MSB(&head, offset % 8);
       IOS_CHAR_GET_LSB(&tail, 8 - lastbyte_bits);
 
       /* Write the byte back without changing the surrounding bits.  */
       c[0] = head | tail | (value << (8 - lastbyte_bits));
-      IOS_PUT_C_ERR_CHCK(c, io, 1, offset / 8);
+      IOS_PUT_C_ERR_CHCK(c, io, flags, 1, offset / 8);
       return IOS_OK;
     }
 
   case 1:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + 1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + 1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB && bits > 8)
@@ -1177,15 +2030,15 @@ ios_write_int_common (ios io, ios_off offset, int flags,
       }
     c[0] |= value >> lastbyte_bits;
     c[1] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 2, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 2, offset / 8);
     return IOS_OK;
 
   case 2:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + bytes_minus1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB)
@@ -1204,15 +2057,15 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     c[0] |= value >> (8 + lastbyte_bits);
     c[1] = (value >> lastbyte_bits) & 0xff;
     c[2] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 3, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 3, offset / 8);
     return IOS_OK;
 
   case 3:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + bytes_minus1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB)
@@ -1234,15 +2087,15 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     c[1] = (value >> (8 + lastbyte_bits)) & 0xff;
     c[2] = (value >> lastbyte_bits) & 0xff;
     c[3] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 4, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 4, offset / 8);
     return IOS_OK;
 
   case 4:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + bytes_minus1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB)
@@ -1267,15 +2120,15 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     c[2] = (value >> (8 + lastbyte_bits)) & 0xff;
     c[3] = (value >> lastbyte_bits) & 0xff;
     c[4] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 5, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 5, offset / 8);
     return IOS_OK;
 
   case 5:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + bytes_minus1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB)
@@ -1303,15 +2156,15 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     c[3] = (value >> (8 + lastbyte_bits)) & 0xff;
     c[4] = (value >> lastbyte_bits) & 0xff;
     c[5] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 6, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 6, offset / 8);
     return IOS_OK;
 
   case 6:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + bytes_minus1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB)
@@ -1342,15 +2195,15 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     c[4] = (value >> (8 + lastbyte_bits)) & 0xff;
     c[5] = (value >> lastbyte_bits) & 0xff;
     c[6] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 7, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 7, offset / 8);
     return IOS_OK;
 
   case 7:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + bytes_minus1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB)
@@ -1384,15 +2237,15 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     c[5] = (value >> (8 + lastbyte_bits)) & 0xff;
     c[6] = (value >> lastbyte_bits) & 0xff;
     c[7] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 8, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 8, offset / 8);
     return IOS_OK;
 
   case 8:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + bytes_minus1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB)
@@ -1418,7 +2271,7 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     c[6] = (value >> (8 + lastbyte_bits)) & 0xff;
     c[7] = (value >> lastbyte_bits) & 0xff;
     c[8] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 9, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 9, offset / 8);
     return IOS_OK;
 
   default:
@@ -1436,6 +2289,16 @@ ios_write_int (ios io, ios_off offset, int flags,
   /* Apply the IOS bias.  */
   offset += ios_get_bias (io);
 
+  /* Negative numbers are encoded as one less in one's complement,
+     which can't represent the most negative number of two's
+     complement.  */
+  if (nenc == IOS_NENC_1 && value < 0)
+    {
+      if (value == (int64_t) ((uint64_t) -1 << (bits - 1)))
+        return IOS_ERANGE;
+      value = (int64_t) ((uint64_t) value - 1);
+    }
+
   /* Fast track for byte-aligned 8x bits  */
   if (offset % 8 == 0 && bits % 8 == 0)
     return ios_write_int_fast (io, offset, flags, bits, endian, value);
@@ -1482,9 +2345,10 @@ ios_write_string (ios io, ios_off offset, int flags,
       p = value;
       do
         {
-          if (io->dev_if->pwrite (io->dev, p, 1,
-                                  offset / 8 + p - value) == IOD_EOF)
-            return IOS_EIOFF;
+          int ret = ios_pwrite (io, flags, p, 1, offset / 8 + p - value);
+
+          if (ret != IOS_OK)
+            return ret;
         }
       while (*(p++) != '\0');
     }
@@ -1500,7 +2364,7 @@ ios_write_string (ios io, ios_off offset, int flags,
           int ret = ios_write_uint (io, offset, flags, 8,
                                     IOS_ENDIAN_MSB, /* Arbitrary.  */
                                     (uint64_t) *p);
-          if (ret == IOS_EIOFF)
+          if (ret != IOS_OK)
             return ret;
 
           offset += 8;
@@ -1512,14 +2376,630 @@ ios_write_string (ios io, ios_off offset, int flags,
   return IOS_OK;
 }
 
+int
+ios_write_bytes (ios io, ios_off offset, int flags,
+                 size_t count, const void *buf)
+{
+  const uint8_t *p = buf;
+  uint8_t chunk[IOS_BYTES_CHUNK + 1];
+  int shift;
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  /* Fast track for byte-aligned offsets: just write the bytes to the
+     IOD.  */
+  if (offset % 8 == 0)
+    return count == 0 ? IOS_OK : ios_pwrite (io, flags, buf, count,
+                                             offset / 8);
+
+  /* Otherwise every written byte spans two bytes in the IOD.  The
+     bits in the first and the last affected bytes that are not
+     written shall be preserved.  */
+  shift = offset % 8;
+  offset /= 8;
+  while (count > 0)
+    {
+      size_t i, n = count > IOS_BYTES_CHUNK ? IOS_BYTES_CHUNK : count;
+      uint8_t first, last;
+      int ret;
+
+      /* Bytes past the end of the IOD are considered to be zero.  */
+      ret = ios_pread (io, flags, &first, 1, offset);
+      if (ret == IOS_EIOFF)
+        first = 0;
+      else if (ret != IOS_OK)
+        return ret;
+
+      ret = ios_pread (io, flags, &last, 1, offset + n);
+      if (ret == IOS_EIOFF)
+        last = 0;
+      else if (ret != IOS_OK)
+        return ret;
+
+      memset (chunk, 0, n + 1);
+      chunk[0] = first & (0xff << (8 - shift));
+      chunk[n] = last & (0xff >> shift);
+      for (i = 0; i < n; ++i)
+        {
+          chunk[i] |= p[i] >> shift;
+          chunk[i + 1] |= p[i] << (8 - shift);
+        }
+
+      if ((ret = ios_pwrite (io, flags, chunk, n + 1, offset)) != IOS_OK)
+        return ret;
+
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
+  return IOS_OK;
+}
+
+/* Size of the buffer used to copy data between IO spaces.  */
+
+#define IOS_COPY_CHUNK (1024 * 1024)
+
+int
+ios_copy (ios from_io, ios_off from, ios to_io, ios_off to, uint64_t size)
+{
+  uint64_t nbytes = size / 8, done = 0;
+  int rbits = size % 8;
+  int backwards_p;
+  uint8_t *buf;
+  int ret = IOS_OK;
+
+  if (size == 0 || (from_io == to_io && from == to))
+    return IOS_OK;
+
+  /* If the destination overlaps the source past its beginning, copy
+     from the end, so the source is not overwritten before being
+     read.  */
+  backwards_p = (from_io == to_io && to > from && to - from < size);
+
+  /* Copy the bytes within the kernel if possible.  */
+  if (from_io->dev_if == &ios_dev_file && to_io->dev_if == &ios_dev_file
+      && (from + ios_get_bias (from_io)) % 8 == 0
+      && (to + ios_get_bias (to_io)) % 8 == 0
+      && nbytes <= (size_t) -1
+      && !(from_io == to_io && (to > from ? to - from : from - to) < size))
+    {
+      ios_dev_off fbyte = (from + ios_get_bias (from_io)) / 8;
+      ios_dev_off tbyte = (to + ios_get_bias (to_io)) / 8;
+
+      if ((ret = ios_cache_invalidate (from_io, fbyte, nbytes)) != IOS_OK
+          || (ret = ios_cache_invalidate (to_io, tbyte, nbytes)) != IOS_OK)
+        return ret;
+
+      done = ios_dev_file_copy (from_io->dev, fbyte, to_io->dev, tbyte,
+                                nbytes);
+    }
+
+  /* Copy the trailing bits first when copying backwards.  */
+  if (rbits != 0 && backwards_p)
+    {
+      uint64_t value;
+
+      if ((ret = ios_read_uint (from_io, from + nbytes * 8, 0, rbits,
+                                IOS_ENDIAN_MSB, &value)) != IOS_OK
+          || (ret = ios_write_uint (to_io, to + nbytes * 8, 0, rbits,
+                                    IOS_ENDIAN_MSB, value)) != IOS_OK)
+        return ret;
+    }
+
+  if (done < nbytes)
+    {
+      buf = malloc (nbytes - done < IOS_COPY_CHUNK
+                    ? nbytes - done : IOS_COPY_CHUNK);
+      if (!buf)
+        return IOS_ENOMEM;
+
+      while (done < nbytes)
+        {
+          uint64_t n = nbytes - done < IOS_COPY_CHUNK
+                       ? nbytes - done : IOS_COPY_CHUNK;
+          uint64_t pos = backwards_p ? nbytes - done - n : done;
+
+          /* Big transfers are better served by the devices directly
+             than by the caches.  */
+          if ((ret = ios_read_bytes (from_io, from + pos * 8,
+                                     IOS_F_BYPASS_CACHE, n, buf)) != IOS_OK
+              || (ret = ios_write_bytes (to_io, to + pos * 8,
+                                         IOS_F_BYPASS_CACHE, n,
+                                         buf)) != IOS_OK)
+            break;
+          done += n;
+        }
+
+      free (buf);
+      if (ret != IOS_OK)
+        return ret;
+    }
+
+  if (rbits != 0 && !backwards_p)
+    {
+      uint64_t value;
+
+      if ((ret = ios_read_uint (from_io, from + nbytes * 8, 0, rbits,
+                                IOS_ENDIAN_MSB, &value)) != IOS_OK
+          || (ret = ios_write_uint (to_io, to + nbytes * 8, 0, rbits,
+                                    IOS_ENDIAN_MSB, value)) != IOS_OK)
+        return ret;
+    }
+
+  return IOS_OK;
+}
+
+/* Size of the blocks in which IO spaces are searched.  */
+
+#define IOS_SEARCH_CHUNK (1024 * 1024)
+
+/* Return a pointer to the first occurrence in the COUNT bytes of BUF
+   of the LEN bytes of PATTERN, masked with MASK, or NULL if there is
+   none.  The bits of PATTERN not set in MASK shall be zero.  SHIFT
+   tells how far the pattern can be advanced for every value of the
+   byte of BUF under its last byte.  */
+
+static const uint8_t *
+ios_search_masked (const uint8_t *buf, size_t count,
+                   const uint8_t *pattern, const uint8_t *mask,
+                   size_t len, const size_t *shift)
+{
+  const uint8_t *p = buf;
+
+  while ((size_t) (buf + count - p) >= len)
+    {
+      uint8_t c = p[len - 1];
+
+      if ((c & mask[len - 1]) == pattern[len - 1])
+        {
+          size_t i;
+
+          for (i = 0; i < len - 1; ++i)
+            if ((p[i] & mask[i]) != pattern[i])
+              break;
+          if (i == len - 1)
+            return p;
+        }
+
+      p += shift[c];
+    }
+
+  return NULL;
+}
+
+int
+ios_find (ios io, ios_off offset, uint64_t size,
+          const uint8_t *pattern, const uint8_t *mask, size_t len,
+          uint64_t max, ios_off **hits, uint64_t *nhits)
+{
+  uint64_t nbytes = size / 8, done = 0, hits_size = 0;
+  uint64_t io_size = ios_size (io);
+  ios_off start = offset + ios_get_bias (io);
+  uint8_t *buf = NULL, *masked = NULL;
+  size_t keep = 0, shift[256];
+  int ret = IOS_OK;
+  size_t i;
+
+  *hits = NULL;
+  *nhits = 0;
+
+  /* Don't look past the end of the IO space.  */
+  if (start >= io_size)
+    nbytes = 0;
+  else if (nbytes > (io_size - start) / 8)
+    nbytes = (io_size - start) / 8;
+
+  if (len == 0 || nbytes < len)
+    return IOS_OK;
+
+  if (len > (size_t) -1 - IOS_SEARCH_CHUNK)
+    return IOS_ENOMEM;
+
+  /* Masked patterns are searched using the Boyer-Moore-Horspool
+     algorithm.  Patterns without wildcards are left to memmem.  */
+  if (mask != NULL)
+    {
+      for (i = 0; i < len; ++i)
+        if (mask[i] != 0xff)
+          break;
+      if (i == len)
+        mask = NULL;
+    }
+
+  if (mask != NULL)
+    {
+      masked = malloc (len);
+      if (!masked)
+        return IOS_ENOMEM;
+
+      for (i = 0; i < 256; ++i)
+        shift[i] = len;
+      for (i = 0; i < len; ++i)
+        {
+          masked[i] = pattern[i] & mask[i];
+          if (i == len - 1)
+            break;
+
+          if (mask[i] == 0xff)
+            shift[masked[i]] = len - 1 - i;
+          else
+            {
+              int c;
+
+              for (c = 0; c < 256; ++c)
+                if ((c & mask[i]) == masked[i])
+                  shift[c] = len - 1 - i;
+            }
+        }
+      pattern = masked;
+    }
+
+  /* The last LEN - 1 bytes of every block are kept at the beginning
+     of the buffer, so matches crossing the boundaries between blocks
+     are found.  */
+  buf = malloc (IOS_SEARCH_CHUNK + len - 1);
+  if (!buf)
+    {
+      ret = IOS_ENOMEM;
+      goto done;
+    }
+
+  while (done < nbytes)
+    {
+      size_t n = (nbytes - done < IOS_SEARCH_CHUNK
+                  ? nbytes - done : IOS_SEARCH_CHUNK);
+      size_t count = keep + n;
+      const uint8_t *p = buf, *hit;
+
+      ret = ios_read_bytes (io, offset + done * 8, IOS_F_BYPASS_CACHE,
+                            n, buf + keep);
+      if (ret != IOS_OK)
+        break;
+
+      while ((hit = (mask != NULL
+                     ? ios_search_masked (p, buf + count - p,
+                                          pattern, mask, len, shift)
+                     : memmem (p, buf + count - p, pattern, len))) != NULL)
+        {
+          if (*nhits == hits_size)
+            {
+              uint64_t new_size = hits_size == 0 ? 64 : hits_size * 2;
+              ios_off *new_hits = realloc (*hits,
+                                           new_size * sizeof (ios_off));
+
+              if (!new_hits)
+                {
+                  ret = IOS_ENOMEM;
+                  goto done;
+                }
+              *hits = new_hits;
+              hits_size = new_size;
+            }
+
+          (*hits)[(*nhits)++] = offset + (done - keep + (hit - buf)) * 8;
+          if (*nhits == max)
+            goto done;
+          p = hit + 1;
+        }
+
+      done += n;
+      keep = count < len - 1 ? count : len - 1;
+      memmove (buf, buf + count - keep, keep);
+    }
+
+ done:
+  free (buf);
+  free (masked);
+  if (ret != IOS_OK)
+    {
+      free (*hits);
+      *hits = NULL;
+      *nhits = 0;
+    }
+  return ret;
+}
+
+/* Size of the blocks in which the ranges of IO spaces are compared,
+   and of the sub-blocks that are compared at a time in order to skip
+   the parts of them that are equal.  */
+
+#define IOS_DIFF_CHUNK (1024 * 1024)
+#define IOS_DIFF_BLOCK 64
+
+/* Add the extent of SIZE bytes at the byte OFFSET to the NEXTENTS
+   extents in EXTENTS, which has room for EXTENTS_SIZE extents.  If it
+   is adjacent to the last extent, they are merged.  */
+
+static int
+ios_diff_add (ios_off **extents, uint64_t *nextents,
+              uint64_t *extents_size, uint64_t offset, uint64_t size)
+{
+  if (*nextents > 0)
+    {
+      ios_off *last = *extents + (*nextents - 1) * 2;
+
+      if (last[0] + last[1] == offset * 8)
+        {
+          last[1] += size * 8;
+          return IOS_OK;
+        }
+    }
+
+  if (*nextents == *extents_size)
+    {
+      uint64_t new_size = *extents_size == 0 ? 64 : *extents_size * 2;
+      ios_off *new_extents = realloc (*extents,
+                                      new_size * 2 * sizeof (ios_off));
+
+      if (!new_extents)
+        return IOS_ENOMEM;
+      *extents = new_extents;
+      *extents_size = new_size;
+    }
+
+  (*extents)[*nextents * 2] = offset * 8;
+  (*extents)[*nextents * 2 + 1] = size * 8;
+  (*nextents)++;
+  return IOS_OK;
+}
+
+/* Return the number of the first NBYTES bytes at OFFSET that are in
+   the space IO.  */
+
+static uint64_t
+ios_diff_avail (ios io, ios_off offset, uint64_t nbytes)
+{
+  ios_off start = offset + ios_get_bias (io);
+  uint64_t io_size = ios_size (io);
+
+  if (start >= io_size)
+    return 0;
+  if (nbytes > (io_size - start) / 8)
+    return (io_size - start) / 8;
+  return nbytes;
+}
+
+int
+ios_diff (ios io1, ios_off offset1, ios io2, ios_off offset2,
+          uint64_t size, ios_off **extents, uint64_t *nextents)
+{
+  uint64_t nbytes = size / 8, done = 0, extents_size = 0;
+  uint64_t avail1 = ios_diff_avail (io1, offset1, nbytes);
+  uint64_t avail2 = ios_diff_avail (io2, offset2, nbytes);
+  uint64_t common = avail1 < avail2 ? avail1 : avail2;
+  uint8_t *buf1 = NULL, *buf2 = NULL;
+  int ret = IOS_OK;
+
+  *extents = NULL;
+  *nextents = 0;
+
+  if (common > 0)
+    {
+      buf1 = malloc (IOS_DIFF_CHUNK);
+      buf2 = malloc (IOS_DIFF_CHUNK);
+      if (!buf1 || !buf2)
+        {
+          ret = IOS_ENOMEM;
+          goto done;
+        }
+    }
+
+  while (done < common)
+    {
+      size_t n = (common - done < IOS_DIFF_CHUNK
+                  ? common - done : IOS_DIFF_CHUNK);
+      size_t i;
+
+      ret = ios_read_bytes (io1, offset1 + done * 8, IOS_F_BYPASS_CACHE,
+                            n, buf1);
+      if (ret != IOS_OK)
+        goto done;
+      ret = ios_read_bytes (io2, offset2 + done * 8, IOS_F_BYPASS_CACHE,
+                            n, buf2);
+      if (ret != IOS_OK)
+        goto done;
+
+      /* Most of the data is usually equal, so blocks are compared
+         with memcmp and only the ones that differ are looked at byte
+         by byte.  */
+      if (memcmp (buf1, buf2, n) != 0)
+        for (i = 0; i < n; i += IOS_DIFF_BLOCK)
+          {
+            size_t end = n - i < IOS_DIFF_BLOCK ? n : i + IOS_DIFF_BLOCK;
+            size_t j = i, k;
+
+            if (memcmp (buf1 + i, buf2 + i, end - i) == 0)
+              continue;
+
+            while (j < end)
+              {
+                if (buf1[j] == buf2[j])
+                  {
+                    j++;
+                    continue;
+                  }
+
+                for (k = j; k < end && buf1[k] != buf2[k]; ++k)
+                  ;
+                ret = ios_diff_add (extents, nextents, &extents_size,
+                                    done + j, k - j);
+                if (ret != IOS_OK)
+                  goto done;
+                j = k;
+              }
+          }
+
+      done += n;
+    }
+
+  /* The bytes that are in only one of the ranges differ.  */
+  if (avail1 != avail2)
+    ret = ios_diff_add (extents, nextents, &extents_size, common,
+                        (avail1 > avail2 ? avail1 : avail2) - common);
+
+ done:
+  free (buf1);
+  free (buf2);
+  if (ret != IOS_OK)
+    {
+      free (*extents);
+      *extents = NULL;
+      *nextents = 0;
+    }
+  return ret;
+}
+
 uint64_t
 ios_size (ios io)
 {
   return io->dev_if->size (io->dev) * 8;
 }
 
+int
+ios_stream_p (ios io)
+{
+  return io->dev_if->stream != 0;
+}
+
 int
 ios_flush (ios io, ios_off offset)
 {
-  return io->dev_if->flush (io->dev, offset);
+  /* The data cached from live devices may be stale.  */
+  int ret = io->dev_if->live ? ios_cache_drop (io) : ios_cache_sync (io);
+
+  if (ret != IOS_OK)
+    return ret;
+
+  return io->dev_if->flush (io->dev, offset / 8);
+}
+
+void
+ios_prefetch (ios io, ios_off offset, int flags, size_t count)
+{
+  ios_dev_off boff;
+
+  if (count == 0 || !ios_cache_p (io, flags))
+    return;
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  boff = (offset / 8) & ~((ios_dev_off) io->cache->block_size - 1);
+  ios_cache_fill (io, boff, offset / 8 - boff + count + (offset % 8 != 0));
+}
+
+int
+ios_read_raw (ios io, uint64_t offset, size_t count, void *buf)
+{
+  return ios_pread (io, 0 /* flags */, buf, count, offset);
+}
+
+int
+ios_write_raw (ios io, uint64_t offset, size_t count, const void *buf)
+{
+  return ios_pwrite (io, 0 /* flags */, buf, count, offset);
+}
+
+int
+ios_overlay_commit (ios io)
+{
+  if (io->dev_if != &ios_dev_overlay)
+    return IOS_ERROR;
+
+  return ios_dev_overlay_commit (io->dev);
+}
+
+int
+ios_overlay_discard (ios io)
+{
+  if (io->dev_if != &ios_dev_overlay)
+    return IOS_ERROR;
+
+  ios_dev_overlay_discard (io->dev);
+  return IOS_OK;
+}
+
+struct ios_overlay_map_closure
+{
+  ios io;
+  ios_overlay_map_fn cb;
+  void *data;
+};
+
+static void
+ios_overlay_map_extent (ios_dev_off offset, size_t size, void *data)
+{
+  struct ios_overlay_map_closure *closure = data;
+
+  closure->cb (closure->io, offset * 8, (uint64_t) size * 8,
+               closure->data);
+}
+
+int
+ios_overlay_map (ios io, ios_overlay_map_fn cb, void *data)
+{
+  struct ios_overlay_map_closure closure = { io, cb, data };
+
+  if (io->dev_if != &ios_dev_overlay)
+    return IOS_ERROR;
+
+  ios_dev_overlay_map (io->dev, ios_overlay_map_extent, &closure);
+  return IOS_OK;
+}
+
+uint64_t
+ios_cache_size (void)
+{
+  return ios_cache_size_setting;
+}
+
+uint64_t
+ios_cache_block_size (void)
+{
+  return ios_cache_block_size_setting;
+}
+
+/* Drop the caches of all the open IO spaces, so they get created
+   again with the current settings.  */
+
+static void
+ios_cache_reset (void)
+{
+  ios io;
+
+  for (io = io_list; io; io = io->next)
+    ios_cache_drop (io);
+}
+
+void
+ios_set_cache_size (uint64_t size)
+{
+  ios_cache_size_setting = size;
+  ios_cache_reset ();
+}
+
+int
+ios_set_cache_block_size (uint64_t block_size)
+{
+  /* The block size should be a power of two.  */
+  if (block_size == 0 || (block_size & (block_size - 1)) != 0)
+    return IOS_ERROR;
+
+  ios_cache_block_size_setting = block_size;
+  ios_cache_reset ();
+  return IOS_OK;
+}
+
+uint64_t
+ios_cache_hits (ios io)
+{
+  return io->hits;
+}
+
+uint64_t
+ios_cache_misses (ios io)
+{
+  return io->misses;
 }
@@ -120,6 +120,12 @@ typedef int64_t ios_off;
 #define IOS_M_WRONLY (IOS_F_WRITE)
 #define IOS_M_RDWR (IOS_F_READ | IOS_F_WRITE)
 
+/* IOD-specific flags.  */
+
+#define IOS_F_DIRECT ((uint64_t) 1 << 32) /* File devices: bypass the
+                                             page cache of the system
+                                             using O_DIRECT.  */
+
 /* **************** IO space collection API ****************
 
    The collection of open IO spaces are organized in a global list.
@@ -153,9 +159,12 @@ int ios_open (const char *handler, uint64_t flags, int set_cur)
   __attribute__ ((visibility ("hidden")));
 
 /* Close the given IO space, freing all used resources and flushing
-   the space cache associated with the space.  */
+   the space cache associated with the space.  Return IOS_OK on
+   success, or IOS_ERROR if the modified contents of the space could
+   not be written back or the device could not be closed.  Note that
+   the IO space is closed in either case.  */
 
-void ios_close (ios io)
+int ios_close (ios io)
   __attribute__ ((visibility ("hidden")));
 
 /* Return the flags which are active in a given IO.  Note that this
@@ -228,6 +237,12 @@ void ios_map (ios_map_fn cb, void *data)
 uint64_t ios_size (ios io)
   __attribute__ ((visibility ("hidden")));
 
+/* Return 1 if the size of the given IO is not final, i.e. reading
+   past it may succeed, and 0 otherwise.  */
+
+int ios_stream_p (ios io)
+  __attribute__ ((visibility ("hidden")));
+
 /* The IOS bias is added to every offset used in a read/write
    operation.  It is signed and measured in bits.  By default it is
    zero, i.e. no bias is applied.
@@ -241,15 +256,60 @@ ios_off ios_get_bias (ios io)
 void ios_set_bias (ios io, ios_off bias)
   __attribute__ ((visibility ("hidden")));
 
+/* **************** IO space cache ****************
+
+   Read and write operations on IO spaces are served from a per-space
+   cache of fixed-size blocks of device bytes.  The cache is
+   write-back: modified blocks are written to the underlying IO
+   device when they are evicted from the cache, when the space is
+   flushed with ios_flush and when the space is closed.
+
+   The size of the cache associated with every IO space, and the size
+   of the blocks composing it, are global settings.  Both are
+   measured in bytes.  Changing either setting writes back and
+   discards the contents of the caches of all open IO spaces.  */
+
+#define IOS_CACHE_DEFAULT_SIZE (1024 * 1024)
+#define IOS_CACHE_DEFAULT_BLOCK_SIZE 4096
+
+/* Get and set the size of the cache associated with IO spaces.  A
+   size smaller than the block size disables caching.  */
+
+uint64_t ios_cache_size (void)
+  __attribute__ ((visibility ("hidden")));
+
+void ios_set_cache_size (uint64_t size)
+  __attribute__ ((visibility ("hidden")));
+
+/* Get and set the size of the cache blocks.  The block size shall be
+   a power of two.  ios_set_cache_block_size returns IOS_ERROR if
+   BLOCK_SIZE is not valid, IOS_OK otherwise.  */
+
+uint64_t ios_cache_block_size (void)
+  __attribute__ ((visibility ("hidden")));
+
+int ios_set_cache_block_size (uint64_t block_size)
+  __attribute__ ((visibility ("hidden")));
+
+/* Return the number of accesses to blocks of IO that were served by
+   the cache, and the number of accesses that required to access the
+   IO device.  */
+
+uint64_t ios_cache_hits (ios io)
+  __attribute__ ((visibility ("hidden")));
+
+uint64_t ios_cache_misses (ios io)
+  __attribute__ ((visibility ("hidden")));
+
 /* **************** Object read/write API ****************  */
 
 /* An integer with flags is passed to the read/write operations,
    impacting the way the operation is performed.  */
 
 #define IOS_F_BYPASS_CACHE  1  /* Bypass the IO space cache.  This
-                                  makes this write operation to
-                                  immediately write to the underlying
-                                  IO device.  */
+                                  makes this read or write operation
+                                  to immediately access the
+                                  underlying IO device.  */
 
 #define IOS_F_BYPASS_UPDATE 2  /* Do not call update hooks that would
                                   be triggered by this write
@@ -273,6 +333,16 @@ void ios_set_bias (ios io, ios_off bias)
 
 #define IOS_EFLAGS -3 /* Invalid flags specified.  */
 
+/* The following error code is returned by ios_read_string when the
+   string is longer than IOS_STRING_MAX bytes.  */
+
+#define IOS_ETOOLONG -5 /* The string is too long.  */
+
+/* The following error code is returned by ios_write_int when the
+   value can't be represented in the requested negative encoding.  */
+
+#define IOS_ERANGE -6 /* The value is out of range.  */
+
 /* When reading and writing integers from/to IO spaces, it is needed
    to specify some details on how the integers values are encoded in
    the underlying storage.  The following enumerations provide the
@@ -312,16 +382,55 @@ int ios_read_uint (ios io, ios_off offset, int flags,
                    uint64_t *value)
   __attribute__ ((visibility ("hidden")));
 
+/* Read COUNT consecutive unsigned integers of size BITS, the first
+   of them located at the given OFFSET, and put their values in the
+   array VALUES, whose elements are WIDTH bytes wide.  WIDTH shall be
+   1, 2, 4 or 8, and big enough to hold BITS bits.  It is assumed the
+   integers are encoded using the ENDIAN byte endianness.  */
+
+int ios_read_uints (ios io, ios_off offset, int flags,
+                    int bits,
+                    enum ios_endian endian,
+                    size_t count, int width, void *values)
+  __attribute__ ((visibility ("hidden")));
+
+/* Like ios_read_uints, but reaching the end of the IO space is not
+   an error: the number of integers actually read is put in
+   NREAD.  */
+
+int ios_read_uints_upto (ios io, ios_off offset, int flags,
+                         int bits,
+                         enum ios_endian endian,
+                         size_t count, int width, void *values,
+                         size_t *nread)
+  __attribute__ ((visibility ("hidden")));
+
 /* Read a NULL-terminated string of bytes located at the given OFFSET,
    and put its value in VALUE.  It is up to the caller to free the
-   memory occupied by the returned string, when no longer needed.  */
+   memory occupied by the returned string, when no longer needed.
+
+   If no NULL byte is found in the first IOS_STRING_MAX bytes, return
+   IOS_ETOOLONG.  This avoids reading whole IO spaces when trying to
+   read strings from data that doesn't contain them.  */
+
+#define IOS_STRING_MAX (16 * 1024 * 1024)
 
 int ios_read_string (ios io, ios_off offset, int flags, char **value)
   __attribute__ ((visibility ("hidden")));
 
+/* Read COUNT bytes located at the given OFFSET, and put them in the
+   buffer BUF, which shall be big enough to hold them.  OFFSET doesn't
+   need to be aligned to a byte boundary.  */
+
+int ios_read_bytes (ios io, ios_off offset, int flags,
+                    size_t count, void *buf)
+  __attribute__ ((visibility ("hidden")));
+
 /* Write the signed integer of size BITS in VALUE to the space IO, at
    the given OFFSET.  Use the byte endianness ENDIAN and encoding NENC
-   when writing the value.  */
+   when writing the value.  Return IOS_ERANGE if VALUE can't be
+   represented in BITS bits with the encoding NENC, like the most
+   negative value in one's complement.  */
 
 int ios_write_int (ios io, ios_off offset, int flags,
                    int bits,
@@ -347,7 +456,83 @@ int ios_write_string (ios io, ios_off offset, int flags,
                       const char *value)
   __attribute__ ((visibility ("hidden")));
 
-/* If the current IOD is a write stream, write out the data in the buffer
+/* Write the COUNT bytes in the buffer BUF to the space IO, at the
+   given OFFSET.  OFFSET doesn't need to be aligned to a byte
+   boundary.  */
+
+int ios_write_bytes (ios io, ios_off offset, int flags,
+                     size_t count, const void *buf)
+  __attribute__ ((visibility ("hidden")));
+
+/* Copy SIZE bits located at the offset FROM of the space FROM_IO to
+   the offset TO of the space TO_IO.  Neither the offsets nor SIZE
+   need to be aligned to a byte boundary.  If both ranges are in the
+   same space, they may overlap.
+
+   The copy is performed in big chunks of bytes, or within the kernel
+   when both spaces operate on files and the system supports it.  */
+
+int ios_copy (ios from_io, ios_off from, ios to_io, ios_off to,
+              uint64_t size)
+  __attribute__ ((visibility ("hidden")));
+
+/* Search the LEN bytes in PATTERN in the SIZE bits of the space IO
+   located at the given OFFSET.  The pattern is looked for at every
+   byte starting at OFFSET, which doesn't need to be aligned to a byte
+   boundary.  If MASK is not NULL, it contains LEN bytes telling which
+   bits of every byte of PATTERN shall match.  The part of the range
+   past the end of the space is not searched.
+
+   The offsets of the matches, which may overlap, are stored in a
+   malloc'ed buffer returned in HITS, and their number in NHITS.  If
+   MAX is not zero, the search stops after MAX matches.  */
+
+int ios_find (ios io, ios_off offset, uint64_t size,
+              const uint8_t *pattern, const uint8_t *mask, size_t len,
+              uint64_t max, ios_off **hits, uint64_t *nhits)
+  __attribute__ ((visibility ("hidden")));
+
+/* Compare the SIZE bits of the space IO1 located at OFFSET1 with the
+   SIZE bits of the space IO2 located at OFFSET2, byte by byte.
+   Neither the offsets nor SIZE need to be aligned to a byte boundary,
+   but only the whole bytes in SIZE are compared.  Bytes that are past
+   the end of only one of the spaces are considered to differ.
+
+   The extents of bytes that differ are stored in a malloc'ed buffer
+   returned in EXTENTS, as pairs of offset and size relative to the
+   beginning of the ranges, and their number in NEXTENTS.  */
+
+int ios_diff (ios io1, ios_off offset1, ios io2, ios_off offset2,
+              uint64_t size, ios_off **extents, uint64_t *nextents)
+  __attribute__ ((visibility ("hidden")));
+
+/* Announce that the COUNT bytes located at the given OFFSET are
+   going to be read soon.  The blocks containing them that are not in
+   the cache of IO are read from the device in a single batch, which
+   the device may serve with many reads in flight.  Only part of the
+   bytes may be brought to the cache if COUNT is big.  Errors are
+   ignored, and reported by the actual reads instead.  */
+
+void ios_prefetch (ios io, ios_off offset, int flags, size_t count)
+  __attribute__ ((visibility ("hidden")));
+
+/* Read COUNT bytes from the device operated by IO, starting at the
+   byte OFFSET, and put them in BUF.  Write the COUNT bytes in BUF to
+   the device operated by IO, starting at the byte OFFSET.  The IOS
+   bias is not applied.  These are used by IO devices that are built
+   on top of other IO spaces.  */
+
+int ios_read_raw (ios io, uint64_t offset, size_t count, void *buf)
+  __attribute__ ((visibility ("hidden")));
+
+int ios_write_raw (ios io, uint64_t offset, size_t count,
+                   const void *buf)
+  __attribute__ ((visibility ("hidden")));
+
+/* Write back the modified contents of the cache of IO to the
+   underlying IO device.
+
+   If the current IOD is a write stream, write out the data in the buffer
    till OFFSET.  If the current IOD is a stream IOD, free (if allowed by the
    embedded buffering strategy) bytes up to OFFSET.  This function has no
    impact when called on other IO devices.  */
@@ -355,6 +540,33 @@ int ios_write_string (ios io, ios_off offset, int flags,
 int ios_flush (ios io, ios_off offset)
   __attribute__ ((visibility ("hidden")));
 
+/* **************** Overlay API ****************
+
+   Overlay IO spaces keep the data written to them in memory, on top
+   of the contents of a base IO space.  The following functions
+   return IOS_ERROR if IO is not an overlay IO space.  */
+
+/* Write the data written to the overlay IO to its base IO space, and
+   forget it.  If some write to the base fails, the data that was not
+   written is kept in the overlay.  */
+
+int ios_overlay_commit (ios io)
+  __attribute__ ((visibility ("hidden")));
+
+/* Forget the data written to the overlay IO.  */
+
+int ios_overlay_discard (ios io)
+  __attribute__ ((visibility ("hidden")));
+
+/* Call CB for every extent of data written to the overlay IO, in
+   increasing offset order.  OFFSET and SIZE are measured in bits.  */
+
+typedef void (*ios_overlay_map_fn) (ios io, uint64_t offset,
+                                    uint64_t size, void *data);
+
+int ios_overlay_map (ios io, ios_overlay_map_fn cb, void *data)
+  __attribute__ ((visibility ("hidden")));
+
 /* **************** Update API **************** */
 
 /* XXX: writeme.  */
@@ -425,11 +425,11 @@ pk_ios_open (pk_compiler pkc,
   return ios_open (handler, flags, set_cur_p);
 }
 
-void
+int
 pk_ios_close (pk_compiler pkc, pk_ios io)
 {
   /* XXX use pkc */
-  ios_close ((ios) io);
+  return ios_close ((ios) io) == IOS_OK ? PK_IOS_OK : PK_IOS_ERROR;
 }
 
 int
@@ -444,6 +444,115 @@ pk_ios_size (pk_ios io)
   return ios_size ((ios) io);
 }
 
+/* Translate IOS status codes into PK_IOS status codes.  */
+
+static int
+pk_ios_status (int ret)
+{
+  switch (ret)
+    {
+    case IOS_OK: return PK_IOS_OK;
+    case IOS_EIOFF: return PK_IOS_EOF;
+    default: return PK_IOS_ERROR;
+    }
+}
+
+int
+pk_ios_read (pk_compiler pkc, pk_ios io, uint64_t offset,
+             size_t count, void *buf)
+{
+  /* XXX use pkc */
+  return pk_ios_status (ios_read_bytes ((ios) io, offset, 0 /* flags */,
+                                        count, buf));
+}
+
+int
+pk_ios_write (pk_compiler pkc, pk_ios io, uint64_t offset,
+              size_t count, const void *buf)
+{
+  /* XXX use pkc */
+  return pk_ios_status (ios_write_bytes ((ios) io, offset, 0 /* flags */,
+                                         count, buf));
+}
+
+int
+pk_ios_overlay_commit (pk_compiler pkc, pk_ios io)
+{
+  /* XXX use pkc */
+  return pk_ios_status (ios_overlay_commit ((ios) io));
+}
+
+int
+pk_ios_overlay_discard (pk_compiler pkc, pk_ios io)
+{
+  /* XXX use pkc */
+  return pk_ios_status (ios_overlay_discard ((ios) io));
+}
+
+struct ios_overlay_map_fn_payload
+{
+  pk_ios_overlay_map_fn cb;
+  void *data;
+};
+
+static void
+my_ios_overlay_map_fn (ios io, uint64_t offset, uint64_t size, void *data)
+{
+  struct ios_overlay_map_fn_payload *payload = data;
+  payload->cb ((pk_ios) io, offset, size, payload->data);
+}
+
+int
+pk_ios_overlay_map (pk_compiler pkc, pk_ios io,
+                    pk_ios_overlay_map_fn cb, void *data)
+{
+  struct ios_overlay_map_fn_payload payload = { cb, data };
+  /* XXX use pkc */
+  return pk_ios_status (ios_overlay_map ((ios) io, my_ios_overlay_map_fn,
+                                         (void *) &payload));
+}
+
+uint64_t
+pk_ios_cache_hits (pk_ios io)
+{
+  return ios_cache_hits ((ios) io);
+}
+
+uint64_t
+pk_ios_cache_misses (pk_ios io)
+{
+  return ios_cache_misses ((ios) io);
+}
+
+uint64_t
+pk_ios_cache_size (pk_compiler pkc)
+{
+  /* XXX use pkc */
+  return ios_cache_size ();
+}
+
+void
+pk_set_ios_cache_size (pk_compiler pkc, uint64_t size)
+{
+  /* XXX use pkc */
+  ios_set_cache_size (size);
+}
+
+uint64_t
+pk_ios_cache_block_size (pk_compiler pkc)
+{
+  /* XXX use pkc */
+  return ios_cache_block_size ();
+}
+
+int
+pk_set_ios_cache_block_size (pk_compiler pkc, uint64_t block_size)
+{
+  /* XXX use pkc */
+  return (ios_set_cache_block_size (block_size) == IOS_OK
+          ? PK_OK : PK_ERROR);
+}
+
 struct ios_map_fn_payload
 {
   pk_ios_map_fn cb;
@@ -578,6 +687,197 @@ pk_decl_val (pk_compiler pkc, const char *name)
   return pvm_env_lookup (runtime_env, back, over);
 }
 
+/* Maximum number of bytes in the signature of a struct type.  */
+
+#define PK_SIGNATURE_MAX 64
+
+/* Strip the casts around the expression EXP.  */
+
+static pkl_ast_node
+strip_casts (pkl_ast_node exp)
+{
+  while (PKL_AST_CODE (exp) == PKL_AST_CAST)
+    exp = PKL_AST_CAST_EXP (exp);
+  return exp;
+}
+
+/* If CONSTRAINT has the form NAME == CONSTANT, or CONSTANT == NAME,
+   and CONSTANT fits in an integral field of SIZE bits and signedness
+   SIGNED_P, set *VALUE to the bits of the field and return 1.  Return
+   0 otherwise.  */
+
+static int
+constraint_value (pkl_ast_node constraint, const char *name,
+                  int size, int signed_p, uint64_t *value)
+{
+  pkl_ast_node op1, op2, type;
+  uint64_t v;
+  int csize;
+
+  if (PKL_AST_CODE (constraint) != PKL_AST_EXP
+      || PKL_AST_EXP_CODE (constraint) != PKL_AST_OP_EQ)
+    return 0;
+
+  op1 = strip_casts (PKL_AST_EXP_OPERAND (constraint, 0));
+  op2 = strip_casts (PKL_AST_EXP_OPERAND (constraint, 1));
+  if (PKL_AST_CODE (op1) == PKL_AST_INTEGER)
+    {
+      pkl_ast_node tmp = op1;
+      op1 = op2;
+      op2 = tmp;
+    }
+
+  if (PKL_AST_CODE (op1) != PKL_AST_IDENTIFIER
+      || strcmp (PKL_AST_IDENTIFIER_POINTER (op1), name) != 0
+      || PKL_AST_CODE (op2) != PKL_AST_INTEGER)
+    return 0;
+
+  /* The field is promoted to the type of the constant before
+     comparing them.  The constant must be the result of extending
+     SIZE bits, or the comparison never succeeds.  */
+  type = PKL_AST_TYPE (op2);
+  if (type == NULL || PKL_AST_TYPE_CODE (type) != PKL_TYPE_INTEGRAL)
+    return 0;
+  csize = PKL_AST_TYPE_I_SIZE (type);
+  if (csize < size)
+    return 0;
+
+  v = PKL_AST_INTEGER_VALUE (op2);
+  if (csize < 64)
+    v &= ((uint64_t) 1 << csize) - 1;
+  if (size < csize)
+    {
+      uint64_t high = v >> size;
+      uint64_t ones = ((uint64_t) 1 << (csize - size)) - 1;
+
+      if (high != (signed_p && (v >> (size - 1)) & 1 ? ones : 0))
+        return 0;
+      v &= ((uint64_t) 1 << size) - 1;
+    }
+
+  *value = v;
+  return 1;
+}
+
+char *
+pk_type_signature (pk_compiler pkc, const char *type)
+{
+  pkl_env compiler_env = pkl_get_env (pkc->compiler);
+  pkl_ast_node decl, t;
+  uint8_t pattern[PK_SIGNATURE_MAX];
+  uint8_t mask[PK_SIGNATURE_MAX];
+  uint64_t boffset = 0;
+  size_t len = 0, i;
+  char *sig, *p;
+
+  decl = pkl_env_lookup (compiler_env, PKL_ENV_NS_MAIN, type,
+                         NULL, NULL);
+  if (decl == NULL
+      || PKL_AST_DECL_KIND (decl) != PKL_AST_DECL_KIND_TYPE)
+    return NULL;
+
+  t = PKL_AST_DECL_INITIAL (decl);
+  if (PKL_AST_TYPE_CODE (t) != PKL_TYPE_STRUCT)
+    return NULL;
+
+  memset (mask, 0, sizeof (mask));
+
+  /* Go through the fields that are at a constant offset, which are
+     the fields before the first field that is not integral or offset,
+     or that has a label or an optional condition.  The fields of
+     unions, pinned structs and integral structs are not at consecutive
+     offsets.  */
+  if (!PKL_AST_TYPE_S_UNION_P (t)
+      && !PKL_AST_TYPE_S_PINNED_P (t)
+      && PKL_AST_TYPE_S_ITYPE (t) == NULL)
+    {
+      for (t = PKL_AST_TYPE_S_ELEMS (t); t; t = PKL_AST_CHAIN (t))
+        {
+          pkl_ast_node ftype, fname, constraint;
+          enum ios_endian endian;
+          uint64_t value;
+          int size;
+
+          if (PKL_AST_CODE (t) != PKL_AST_STRUCT_TYPE_FIELD)
+            continue;
+
+          ftype = PKL_AST_STRUCT_TYPE_FIELD_TYPE (t);
+          fname = PKL_AST_STRUCT_TYPE_FIELD_NAME (t);
+          constraint = PKL_AST_STRUCT_TYPE_FIELD_CONSTRAINT (t);
+
+          if (PKL_AST_STRUCT_TYPE_FIELD_LABEL (t)
+              || PKL_AST_STRUCT_TYPE_FIELD_OPTCOND (t))
+            break;
+
+          if (PKL_AST_TYPE_CODE (ftype) == PKL_TYPE_OFFSET)
+            {
+              /* Offsets are wildcards.  */
+              size = PKL_AST_TYPE_I_SIZE (PKL_AST_TYPE_O_BASE_TYPE (ftype));
+              boffset += size;
+              continue;
+            }
+
+          if (PKL_AST_TYPE_CODE (ftype) != PKL_TYPE_INTEGRAL)
+            break;
+
+          size = PKL_AST_TYPE_I_SIZE (ftype);
+          if (boffset % 8 != 0 || size % 8 != 0
+              || boffset / 8 + size / 8 > PK_SIGNATURE_MAX)
+            {
+              boffset += size;
+              continue;
+            }
+
+          if (fname && constraint
+              && constraint_value (constraint,
+                                   PKL_AST_IDENTIFIER_POINTER (fname),
+                                   size,
+                                   PKL_AST_TYPE_I_SIGNED_P (ftype),
+                                   &value))
+            {
+              switch (PKL_AST_STRUCT_TYPE_FIELD_ENDIAN (t))
+                {
+                case PKL_AST_ENDIAN_MSB: endian = IOS_ENDIAN_MSB; break;
+                case PKL_AST_ENDIAN_LSB: endian = IOS_ENDIAN_LSB; break;
+                default:
+                  endian = pvm_endian (pkc->vm);
+                  break;
+                }
+
+              for (i = 0; i < (size_t) size / 8; ++i)
+                {
+                  int shift = (endian == IOS_ENDIAN_MSB
+                               ? size - 8 * (i + 1) : 8 * i);
+
+                  pattern[boffset / 8 + i] = (value >> shift) & 0xff;
+                  mask[boffset / 8 + i] = 0xff;
+                }
+
+              len = boffset / 8 + size / 8;
+            }
+
+          boffset += size;
+        }
+    }
+
+  /* Every byte is written as two hex digits, or as ?? if it is not
+     known.  Trailing unknown bytes are not included.  */
+  sig = malloc (len * 2 + 1);
+  if (sig == NULL)
+    return NULL;
+
+  for (p = sig, i = 0; i < len; ++i, p += 2)
+    {
+      if (mask[i])
+        sprintf (p, "%02x", pattern[i]);
+      else
+        strcpy (p, "??");
+    }
+  *p = '\0';
+
+  return sig;
+}
+
 int
 pk_defvar (pk_compiler pkc, const char *varname, pk_val val)
 {
@@ -791,6 +1091,18 @@ pk_set_pretty_print (pk_compiler pkc, int pretty_print_p)
   pvm_set_pretty_print (pkc->vm, pretty_print_p);
 }
 
+int
+pk_lazy_map (pk_compiler pkc)
+{
+  return pvm_lazy_map (pkc->vm);
+}
+
+void
+pk_set_lazy_map (pk_compiler pkc, int lazy_map_p)
+{
+  pvm_set_lazy_map (pkc->vm, lazy_map_p);
+}
+
 void
 pk_print_val (pk_compiler pkc, pk_val val)
 {
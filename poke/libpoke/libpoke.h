@@ -255,6 +255,7 @@ uint64_t pk_ios_size (pk_ios ios);
 #define PK_IOS_F_WRITE    2
 #define PK_IOS_F_TRUNCATE 8
 #define PK_IOS_F_CREATE  16
+#define PK_IOS_F_DIRECT  ((uint64_t) 1 << 32)
 
 uint64_t pk_ios_flags (pk_ios ios);
 
@@ -277,9 +278,69 @@ int pk_ios_open (pk_compiler pkc,
                  const char *handler, uint64_t flags, int set_cur_p);
 
 /* Close the given IO space, freing all used resources and flushing
-   the space cache associated with the space.  */
+   the space cache associated with the space.  Return PK_IOS_OK on
+   success, or PK_IOS_ERROR if the modified contents of the space
+   could not be written back.  Note that the IO space is closed in
+   either case.  */
 
-void pk_ios_close (pk_compiler pkc, pk_ios ios);
+int pk_ios_close (pk_compiler pkc, pk_ios ios);
+
+/* Read COUNT bytes from the given IO space, starting at OFFSET, and
+   store them in BUF.  Write the COUNT bytes in BUF to the given IO
+   space, starting at OFFSET.  OFFSET is measured in bits, and it
+   doesn't need to be aligned to a byte boundary.  The IO space bias
+   is applied to OFFSET.
+
+   These functions return PK_IOS_OK on success, PK_IOS_EOF if the
+   requested range exceeds the size of the IO space, and PK_IOS_ERROR
+   on any other error.  */
+
+#define PK_IOS_EOF   -2
+
+int pk_ios_read (pk_compiler pkc, pk_ios ios, uint64_t offset,
+                 size_t count, void *buf);
+int pk_ios_write (pk_compiler pkc, pk_ios ios, uint64_t offset,
+                  size_t count, const void *buf);
+
+/* Overlay IO spaces, opened with the handler overlay://ID, keep the
+   data written to them in memory, on top of the contents of the IO
+   space with the given ID.
+
+   pk_ios_overlay_commit writes the data written to the given overlay
+   IO space to its base IO space, and forgets it.
+   pk_ios_overlay_discard just forgets it.  pk_ios_overlay_map calls
+   CB for every extent of data written to the overlay, in increasing
+   offset order.  OFFSET and SIZE are measured in bits.
+
+   These functions return PK_IOS_OK on success, and PK_IOS_ERROR if
+   IOS is not an overlay IO space or on any other error.  */
+
+typedef void (*pk_ios_overlay_map_fn) (pk_ios ios, uint64_t offset,
+                                       uint64_t size, void *data);
+
+int pk_ios_overlay_commit (pk_compiler pkc, pk_ios ios);
+int pk_ios_overlay_discard (pk_compiler pkc, pk_ios ios);
+int pk_ios_overlay_map (pk_compiler pkc, pk_ios ios,
+                        pk_ios_overlay_map_fn cb, void *data);
+
+/* Return the number of accesses to the given IO space that were
+   served by the IO space cache, and the number of accesses that
+   required to access the underlying IO device.  */
+
+uint64_t pk_ios_cache_hits (pk_ios ios);
+uint64_t pk_ios_cache_misses (pk_ios ios);
+
+/* Get and set the size of the cache associated with every IO space,
+   and the size of the blocks composing it.  Both are measured in
+   bytes.  A cache size smaller than the block size disables caching.
+   The block size shall be a power of two: pk_set_ios_cache_block_size
+   returns PK_ERROR if it is not, PK_OK otherwise.  */
+
+uint64_t pk_ios_cache_size (pk_compiler pkc);
+void pk_set_ios_cache_size (pk_compiler pkc, uint64_t size);
+
+uint64_t pk_ios_cache_block_size (pk_compiler pkc);
+int pk_set_ios_cache_block_size (pk_compiler pkc, uint64_t block_size);
 
 /* Map over all the IO spaces in a given incremental compiler,
    executing a handler.  */
@@ -324,6 +385,20 @@ int pk_decl_p (pk_compiler pkc, const char *name, int kind);
 
 pk_val pk_decl_val (pk_compiler pkc, const char *name);
 
+/* Given the name of a struct type declared in the compiler, return
+   the bytes that any data mapped with that type must begin with.
+
+   The signature is built from the fields at the beginning of the
+   struct that have constraints of the form FIELD == CONSTANT.  It is
+   a string of hex digit pairs, with ?? standing for bytes that can
+   have any value, and it is empty if nothing is known about the
+   contents of the struct.  The returned string is allocated with
+   malloc.
+
+   If there is no struct type named TYPE, return NULL.  */
+
+char *pk_type_signature (pk_compiler pkc, const char *type);
+
 /* Declare a variable in the global environment of the given
    incremental compiler.
 
@@ -399,6 +474,13 @@ void pk_set_nenc (pk_compiler pkc, enum pk_nenc nenc);
 int pk_pretty_print (pk_compiler pkc);
 void pk_set_pretty_print (pk_compiler pkc, int pretty_print_p);
 
+/* Get and set whether mapped arrays are mapped lazily.  The elements
+   of lazy arrays are mapped when they are first accessed, instead of
+   when the array is mapped.  */
+
+int pk_lazy_map (pk_compiler pkc);
+void pk_set_lazy_map (pk_compiler pkc, int lazy_map_p);
+
 /*** API for manipulating Poke values.  ***/
 
 /* PK_NULL is an invalid pk_val.
@@ -597,7 +679,8 @@ pk_val pk_array_nelem (pk_val array);
    ARRAY is the array value.
    IDX is the index of the element in the array.
 
-   If IDX is invalid, PK_NULL is returned. */
+   If IDX is invalid, or the element belongs to an array that is
+   mapped lazily and it can't be mapped, PK_NULL is returned. */
 
 pk_val pk_array_elem_val (pk_val array, uint64_t idx);
 
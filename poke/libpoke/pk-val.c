@@ -395,7 +395,7 @@ pk_val
 pk_array_elem_val (pk_val array, uint64_t idx)
 {
   if (idx < pk_uint_value (pk_array_nelem (array)))
-    return PVM_VAL_ARR_ELEM_VALUE (array, idx);
+    return pvm_array_elem_value (array, idx);
   else
     return PK_NULL;
 }
@@ -404,14 +404,14 @@ void
 pk_array_set_elem_val (pk_val array, uint64_t idx, pk_val val)
 {
   if (idx < pk_uint_value (pk_array_nelem (array)))
-    PVM_VAL_ARR_ELEM_VALUE (array, idx) = val;
+    pvm_array_set_elem_value (array, idx, val);
 }
 
 pk_val
 pk_array_elem_boffset (pk_val array, uint64_t idx)
 {
   if (idx < pk_uint_value (pk_array_nelem (array)))
-    return PVM_VAL_ARR_ELEM_OFFSET (array, idx);
+    return pvm_array_elem_offset (array, idx);
   else
     return PK_NULL;
 }
@@ -420,5 +420,5 @@ void
 pk_array_set_elem_boffset (pk_val array, uint64_t idx, pk_val boffset)
 {
   if (idx < pk_uint_value (pk_array_nelem (array)))
-    PVM_VAL_ARR_ELEM_OFFSET (array, idx) = boffset;
+    pvm_array_set_elem_offset (array, idx, boffset);
 }
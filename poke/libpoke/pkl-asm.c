@@ -1857,6 +1857,118 @@ pkl_asm_for_where (pkl_asm pasm)
   pkl_asm_insn (pasm, PKL_INSN_SWAP);
 }
 
+void
+pkl_asm_for_map (pkl_asm pasm, pkl_ast_node selector)
+{
+  pkl_asm_pushlevel (pasm, PKL_ASM_ENV_FOR_LOOP);
+
+  pasm->level->label1 = pvm_program_fresh_label (pasm->program);
+  pasm->level->label2 = pvm_program_fresh_label (pasm->program);
+  pasm->level->label3 = pvm_program_fresh_label (pasm->program);
+  pasm->level->break_label = pvm_program_fresh_label (pasm->program);
+
+  if (selector)
+    pasm->level->node1 = ASTREF (selector);
+}
+
+void
+pkl_asm_for_map_where (pkl_asm pasm)
+{
+  pvm_program_label mapelem = pvm_program_fresh_label (pasm->program);
+  pvm_program_label unbounded = pvm_program_fresh_label (pasm->program);
+  pvm_program_label mapped = pvm_program_fresh_label (pasm->program);
+  pvm_program_label done = pvm_program_fresh_label (pasm->program);
+
+  /* The IO space and the closure mapping the elements are kept in
+     locals, next to the iterator.  The stack holds the number of
+     elements to map, or null if the loop spans until the end of the
+     IO space, the index of the next element and its bit-offset.  */
+                                                    /* IOS BOFF EBOUND CLS */
+  pkl_asm_insn (pasm, PKL_INSN_PUSHF, 3);
+  pkl_asm_insn (pasm, PKL_INSN_TOR);                /* IOS BOFF EBOUND [CLS] */
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, PVM_NULL);
+  pkl_asm_insn (pasm, PKL_INSN_REGVAR);
+  pkl_asm_insn (pasm, PKL_INSN_ROT);                /* BOFF EBOUND IOS [CLS] */
+  pkl_asm_insn (pasm, PKL_INSN_REGVAR);             /* BOFF EBOUND [CLS] */
+  pkl_asm_insn (pasm, PKL_INSN_FROMR);              /* BOFF EBOUND CLS */
+  pkl_asm_insn (pasm, PKL_INSN_REGVAR);             /* BOFF EBOUND */
+  pkl_asm_insn (pasm, PKL_INSN_SWAP);               /* EBOUND BOFF */
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_ulong (0, 64));
+  pkl_asm_insn (pasm, PKL_INSN_SWAP);               /* EBOUND 0UL BOFF */
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, PVM_NULL);
+
+  pvm_program_append_label (pasm->program, pasm->level->label2);
+
+  /* Check whether all the elements have been mapped.  */
+  pkl_asm_insn (pasm, PKL_INSN_DROP);               /* EBOUND IDX BOFF */
+  pkl_asm_insn (pasm, PKL_INSN_ROT);                /* IDX BOFF EBOUND */
+  pkl_asm_insn (pasm, PKL_INSN_BN, unbounded);
+  pkl_asm_insn (pasm, PKL_INSN_NROT);               /* EBOUND IDX BOFF */
+  pkl_asm_insn (pasm, PKL_INSN_TOR);                /* EBOUND IDX [BOFF] */
+  pkl_asm_insn (pasm, PKL_INSN_EQLU);               /* EBOUND IDX (EBOUND==IDX) [BOFF] */
+  pkl_asm_insn (pasm, PKL_INSN_FROMR);              /* EBOUND IDX (EBOUND==IDX) BOFF */
+  pkl_asm_insn (pasm, PKL_INSN_SWAP);               /* EBOUND IDX BOFF (EBOUND==IDX) */
+  pkl_asm_insn (pasm, PKL_INSN_BNZI, pasm->level->label3);
+  pkl_asm_insn (pasm, PKL_INSN_DROP);               /* EBOUND IDX BOFF */
+  pkl_asm_insn (pasm, PKL_INSN_BA, mapelem);
+  pvm_program_append_label (pasm->program, unbounded);
+  pkl_asm_insn (pasm, PKL_INSN_NROT);               /* EBOUND IDX BOFF */
+  pvm_program_append_label (pasm->program, mapelem);
+
+  /* Map the next element.  Running out of data or violating a
+     constraint terminates the loop.  */
+  pkl_asm_insn (pasm, PKL_INSN_PUSH,
+                pvm_make_exception (PVM_E_EOF, PVM_E_EOF_MSG,
+                                    PVM_E_EOF_ESTATUS));
+  pkl_asm_insn (pasm, PKL_INSN_PUSHE, pasm->level->label1);
+  pkl_asm_insn (pasm, PKL_INSN_PUSH,
+                pvm_make_exception (PVM_E_CONSTRAINT, PVM_E_CONSTRAINT_MSG,
+                                    PVM_E_CONSTRAINT_ESTATUS));
+  pkl_asm_insn (pasm, PKL_INSN_PUSHE, pasm->level->label1);
+  pkl_asm_insn (pasm, PKL_INSN_DUP);                /* EBOUND IDX BOFF BOFF */
+  pkl_asm_insn (pasm, PKL_INSN_PUSHVAR, 0, 1);      /* EBOUND IDX BOFF BOFF IOS */
+  pkl_asm_insn (pasm, PKL_INSN_SWAP);               /* EBOUND IDX BOFF IOS BOFF */
+  pkl_asm_insn (pasm, PKL_INSN_PUSHVAR, 0, 2);      /* EBOUND IDX BOFF IOS BOFF CLS */
+  pkl_asm_insn (pasm, PKL_INSN_CALL);               /* EBOUND IDX BOFF VAL */
+  pkl_asm_insn (pasm, PKL_INSN_POPE);
+  pkl_asm_insn (pasm, PKL_INSN_POPE);
+  pkl_asm_insn (pasm, PKL_INSN_BA, mapped);
+
+  /* If the element could not be mapped, the loop is over.  Unless
+     the number of elements was specified, in which case the
+     exception is propagated, like when mapping the whole array.  */
+  pvm_program_append_label (pasm->program, pasm->level->label1);
+                                                    /* EBOUND IDX BOFF EXCEPTION */
+  pkl_asm_insn (pasm, PKL_INSN_TOR);                /* EBOUND IDX BOFF [EXCEPTION] */
+  pkl_asm_insn (pasm, PKL_INSN_ROT);                /* IDX BOFF EBOUND [EXCEPTION] */
+  pkl_asm_insn (pasm, PKL_INSN_BN, done);
+  pkl_asm_insn (pasm, PKL_INSN_NROT);               /* EBOUND IDX BOFF [EXCEPTION] */
+  pkl_asm_insn (pasm, PKL_INSN_FROMR);              /* EBOUND IDX BOFF EXCEPTION */
+  pkl_asm_insn (pasm, PKL_INSN_RAISE);
+  pvm_program_append_label (pasm->program, done);
+  pkl_asm_insn (pasm, PKL_INSN_NROT);               /* EBOUND IDX BOFF [EXCEPTION] */
+  pkl_asm_insn (pasm, PKL_INSN_FROMR);              /* EBOUND IDX BOFF EXCEPTION */
+  pkl_asm_insn (pasm, PKL_INSN_BA, pasm->level->label3);
+
+  /* Advance the bit-offset past the mapped element.  */
+  pvm_program_append_label (pasm->program, mapped);
+  pkl_asm_insn (pasm, PKL_INSN_SIZ);                /* EBOUND IDX BOFF VAL SIZ */
+  pkl_asm_insn (pasm, PKL_INSN_ROT);                /* EBOUND IDX VAL SIZ BOFF */
+  pkl_asm_insn (pasm, PKL_INSN_ADDLU);              /* EBOUND IDX VAL SIZ BOFF (SIZ+BOFF) */
+  pkl_asm_insn (pasm, PKL_INSN_NIP2);               /* EBOUND IDX VAL (SIZ+BOFF) */
+  pkl_asm_insn (pasm, PKL_INSN_SWAP);               /* EBOUND IDX NBOFF VAL */
+
+  /* Set the iterator for this iteration.  */
+  pkl_asm_insn (pasm, PKL_INSN_POPVAR, 0, 0);       /* EBOUND IDX NBOFF */
+
+  /* Increase the element index.  */
+  pkl_asm_insn (pasm, PKL_INSN_SWAP);               /* EBOUND NBOFF IDX */
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_ulong (1, 64));
+  pkl_asm_insn (pasm, PKL_INSN_ADDLU);
+  pkl_asm_insn (pasm, PKL_INSN_NIP2);               /* EBOUND NBOFF (IDX+1UL) */
+  pkl_asm_insn (pasm, PKL_INSN_SWAP);               /* EBOUND (IDX+1UL) NBOFF */
+}
+
 void
 pkl_asm_for_loop (pkl_asm pasm)
 {
@@ -197,6 +197,32 @@ void pkl_asm_for_loop (pkl_asm pasm)
 void pkl_asm_for_endloop (pkl_asm pasm)
   __attribute__ ((visibility ("hidden")));
 
+/* For-in-where loops over mapped arrays, which map the elements of
+ * the array one at a time instead of mapping the whole array before
+ * the first iteration.
+ *
+ * pkl_asm_for_map (pasm, selector)
+ *
+ * ... ios, bit-offset, number of elements or null, and a closure
+ *     mapping an element at a given ios and bit-offset ...
+ *
+ * pkl_asm_for_map_where (pasm);
+ *
+ * ... selector ...
+ *
+ * pkl_asm_for_loop (pasm);
+ *
+ * ... body ...
+ *
+ * pkl_asm_for_endloop (pasm);
+ */
+
+void pkl_asm_for_map (pkl_asm pasm, pkl_ast_node selector)
+  __attribute__ ((visibility ("hidden")));
+
+void pkl_asm_for_map_where (pkl_asm pasm)
+  __attribute__ ((visibility ("hidden")));
+
 /* Try-catch blocks.
  *
  * pkl_asm_try (pasm);
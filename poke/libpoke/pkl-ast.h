@@ -1359,6 +1359,12 @@ pkl_ast_node pkl_ast_make_var (pkl_ast ast,
 #define PKL_AST_BUILTIN_IOSIZE 9
 #define PKL_AST_BUILTIN_GETENV 10
 #define PKL_AST_BUILTIN_FORGET 11
+#define PKL_AST_BUILTIN_IOCOPY 12
+#define PKL_AST_BUILTIN_IODUMP 13
+#define PKL_AST_BUILTIN_IOSEARCH 14
+#define PKL_AST_BUILTIN_IODIFF 15
+#define PKL_AST_BUILTIN_IOREAD 16
+#define PKL_AST_BUILTIN_IOWRITE 17
 
 struct pkl_ast_comp_stmt
 {
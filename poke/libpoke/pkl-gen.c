@@ -61,6 +61,96 @@
 #define PKL_GEN_POP_ASM2 PKL_GEN_POP_AN_ASM(pasm2)
 
 
+/* Return whether arrays of type ARRAY_TYPE can be mapped by reading
+   all their elements at once, i.e. whether the elements are integral
+   values or offsets.  */
+
+static int
+pkl_gen_fast_array_p (pkl_ast_node array_type)
+{
+  pkl_ast_node etype = PKL_AST_TYPE_A_ETYPE (array_type);
+
+  return (PKL_AST_TYPE_CODE (etype) == PKL_TYPE_INTEGRAL
+          || PKL_AST_TYPE_CODE (etype) == PKL_TYPE_OFFSET);
+}
+
+/* Return the size in bits of the values of type TYPE if it is known
+   at compile-time, i.e. if all the values of the type have the same
+   size.  Otherwise return 0.  */
+
+static uint64_t
+pkl_gen_type_size (pkl_ast_node type)
+{
+  switch (PKL_AST_TYPE_CODE (type))
+    {
+    case PKL_TYPE_INTEGRAL:
+      return PKL_AST_TYPE_I_SIZE (type);
+    case PKL_TYPE_OFFSET:
+      return PKL_AST_TYPE_I_SIZE (PKL_AST_TYPE_O_BASE_TYPE (type));
+    case PKL_TYPE_ARRAY:
+      {
+        pkl_ast_node bound = PKL_AST_TYPE_A_BOUND (type);
+
+        if (bound == NULL || PKL_AST_CODE (bound) != PKL_AST_INTEGER)
+          return 0;
+        return (PKL_AST_INTEGER_VALUE (bound)
+                * pkl_gen_type_size (PKL_AST_TYPE_A_ETYPE (type)));
+      }
+    case PKL_TYPE_STRUCT:
+      {
+        pkl_ast_node elem;
+        uint64_t size = 0;
+
+        if (PKL_AST_TYPE_S_UNION_P (type)
+            || PKL_AST_TYPE_S_PINNED_P (type)
+            || pkl_ast_type_is_complete (type) != PKL_AST_TYPE_COMPLETE_YES)
+          return 0;
+
+        for (elem = PKL_AST_TYPE_S_ELEMS (type);
+             elem;
+             elem = PKL_AST_CHAIN (elem))
+          {
+            if (PKL_AST_CODE (elem) == PKL_AST_STRUCT_TYPE_FIELD)
+              {
+                uint64_t field_size
+                  = pkl_gen_type_size (PKL_AST_STRUCT_TYPE_FIELD_TYPE (elem));
+
+                if (field_size == 0)
+                  return 0;
+                size += field_size;
+              }
+          }
+
+        return size;
+      }
+    default:
+      return 0;
+    }
+}
+
+/* Return whether the elements of the container CONTAINER of a for-in
+   loop can be mapped one at a time, i.e. whether the container is a
+   map of an array whose number of elements is either unbounded or
+   known at compile-time.  Arrays of integral or offset elements are
+   mapped all at once anyway, as these are stored compactly.  */
+
+static int
+pkl_gen_stream_map_p (pkl_ast_node container)
+{
+  pkl_ast_node map_type, bound;
+
+  if (PKL_AST_CODE (container) != PKL_AST_MAP)
+    return 0;
+
+  map_type = PKL_AST_MAP_TYPE (container);
+  if (PKL_AST_TYPE_CODE (map_type) != PKL_TYPE_ARRAY
+      || pkl_gen_fast_array_p (map_type))
+    return 0;
+
+  bound = PKL_AST_TYPE_A_BOUND (map_type);
+  return (bound == NULL || PKL_AST_CODE (bound) == PKL_AST_INTEGER);
+}
+
 /* Code generated by RAS is used in the handlers below.  Configure it
    to use the main assembler in the GEN payload.  Then just include
    the assembled macros in this file.  */
@@ -544,6 +634,83 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_comp_stmt)
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_FLUSH);
           break;
+        case PKL_AST_BUILTIN_IOCOPY:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 3);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 4);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOCOPY);
+          break;
+        case PKL_AST_BUILTIN_IODUMP:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 3);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 4);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 5);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IODUMP);
+          break;
+        case PKL_AST_BUILTIN_IOSEARCH:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 3);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 4);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 5);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOSEARCH);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+          break;
+        case PKL_AST_BUILTIN_IODIFF:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 3);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 4);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IODIFF);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+          break;
+        case PKL_AST_BUILTIN_IOREAD:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PEEKAB);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+          break;
+        case PKL_AST_BUILTIN_IOWRITE:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_POKEAB);
+          break;
         case PKL_AST_BUILTIN_GETENV:
           {
             pvm_program_label label = pkl_asm_fresh_label (PKL_GEN_ASM);
@@ -900,6 +1067,109 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_loop_stmt)
           pkl_asm_while_endloop (PKL_GEN_ASM);
         }
     }
+  else if (iterator && container
+           && pkl_gen_stream_map_p (container))
+    {
+      pkl_ast_node map_type = PKL_AST_MAP_TYPE (container);
+      pkl_ast_node map_ios = PKL_AST_MAP_IOS (container);
+      pkl_ast_node bound = PKL_AST_TYPE_A_BOUND (map_type);
+      pkl_ast_node etype = PKL_AST_TYPE_A_ETYPE (map_type);
+      pvm_val mapper_closure;
+      int bounder_created = 0;
+
+      /* This is a FOR-IN[-WHERE] loop over a mapped array.  Map the
+         elements one at a time, so the array is never built.  */
+      pkl_asm_for_map (PKL_GEN_ASM, condition);
+      {
+        if (map_ios)
+          PKL_PASS_SUBPASS (map_ios);
+        else
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHIOS);
+
+        PKL_PASS_SUBPASS (PKL_AST_MAP_OFFSET (container));
+        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+
+        if (bound)
+          {
+            uint64_t nelem = PKL_AST_INTEGER_VALUE (bound);
+            uint64_t esize
+              = pkl_gen_type_size (PKL_AST_TYPE_A_ETYPE (map_type));
+
+            /* If the size of the elements is known, make sure the
+               whole array fits in the IO space before running the
+               body of the loop for any of its elements, like when
+               mapping the whole array.  */
+            if (esize != 0)
+              {
+                pvm_program_label label
+                  = pkl_asm_fresh_label (PKL_GEN_ASM);
+
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OVER);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOGETB);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH,
+                              pvm_make_ulong (nelem * esize, 64));
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_ADDLU);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP2);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_TOR);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OVER);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_FROMR);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_ADDLU);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP2);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SWAP);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOSIZE);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP2);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_GTLU);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP2);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_BZI, label);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH,
+                              pvm_make_exception (PVM_E_EOF, PVM_E_EOF_MSG,
+                                                  PVM_E_EOF_ESTATUS));
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RAISE);
+                pkl_asm_label (PKL_GEN_ASM, label);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP);
+              }
+
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH,
+                          pvm_make_ulong (nelem, 64));
+          }
+        else
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, PVM_NULL);
+
+        /* Compile the closure mapping the elements and complete it
+           with the current environment, before the loop introduces
+           its own lexical level.  The bounder of an anonymous array
+           element type is installed first, for the same reason.  */
+        if (PKL_AST_TYPE_CODE (etype) == PKL_TYPE_ARRAY
+            && PKL_AST_TYPE_A_BOUNDER (etype) == PVM_NULL)
+          {
+            bounder_created = 1;
+            PKL_GEN_PAYLOAD->in_array_bounder = 1;
+            PKL_PASS_SUBPASS (etype);
+            PKL_GEN_PAYLOAD->in_array_bounder = 0;
+          }
+
+        RAS_FUNCTION_FOR_MAP_MAPPER (mapper_closure, etype);
+        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, mapper_closure);
+        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PEC);
+      }
+      pkl_asm_for_map_where (PKL_GEN_ASM);
+      {
+        if (condition)
+          PKL_PASS_SUBPASS (condition);
+      }
+      pkl_asm_for_loop (PKL_GEN_ASM);
+      {
+        PKL_PASS_SUBPASS (body);
+      }
+      pkl_asm_for_endloop (PKL_GEN_ASM);
+
+      if (bounder_created)
+        pkl_ast_array_type_remove_bounders (etype);
+    }
   else if (iterator && container)
     {
       pkl_ast_node container_type = PKL_AST_TYPE (container);
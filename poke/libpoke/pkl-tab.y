@@ -337,7 +337,9 @@ token <integer> UNION    _("keyword `union'")
 %token LOAD              _("keyword `load'")
 %token BUILTIN_RAND BUILTIN_GET_ENDIAN BUILTIN_SET_ENDIAN
 %token BUILTIN_GET_IOS BUILTIN_SET_IOS BUILTIN_OPEN BUILTIN_CLOSE
-%token BUILTIN_IOSIZE BUILTIN_GETENV BUILTIN_FORGET
+%token BUILTIN_IOSIZE BUILTIN_GETENV BUILTIN_FORGET BUILTIN_IOCOPY
+%token BUILTIN_IODUMP BUILTIN_IOSEARCH BUILTIN_IODIFF BUILTIN_IOREAD
+%token BUILTIN_IOWRITE
 
 /* Compiler builtins.  */
 
@@ -1743,6 +1745,12 @@ builtin:
         | BUILTIN_IOSIZE        { $$ = PKL_AST_BUILTIN_IOSIZE; }
         | BUILTIN_GETENV        { $$ = PKL_AST_BUILTIN_GETENV; }
         | BUILTIN_FORGET        { $$ = PKL_AST_BUILTIN_FORGET; }
+        | BUILTIN_IOCOPY        { $$ = PKL_AST_BUILTIN_IOCOPY; }
+        | BUILTIN_IODUMP        { $$ = PKL_AST_BUILTIN_IODUMP; }
+        | BUILTIN_IOSEARCH      { $$ = PKL_AST_BUILTIN_IOSEARCH; }
+        | BUILTIN_IODIFF        { $$ = PKL_AST_BUILTIN_IODIFF; }
+        | BUILTIN_IOREAD        { $$ = PKL_AST_BUILTIN_IOREAD; }
+        | BUILTIN_IOWRITE       { $$ = PKL_AST_BUILTIN_IOWRITE; }
         ;
 
 stmt_decl_list:
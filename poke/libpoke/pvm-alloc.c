@@ -28,6 +28,19 @@ pvm_alloc (size_t size)
   return GC_MALLOC (size);
 }
 
+void *
+pvm_alloc_atomic (size_t size)
+{
+  return GC_MALLOC_ATOMIC (size);
+}
+
+void *
+pvm_alloc_long (void)
+{
+  /* See pvm-val.h for why these are aligned to 16 bytes.  */
+  return GC_memalign (16, sizeof (uint64_t) * 2);
+}
+
 void *
 pvm_realloc (void *ptr, size_t size)
 {
@@ -51,6 +51,23 @@ void *pvm_alloc (size_t size)
   __attribute__ ((alloc_size (1)))
   __attribute__ ((visibility ("hidden")));
 
+/* Like pvm_alloc, but the allocated memory is not initialized and it
+   is not scanned for pointers by the garbage-collector.  This is
+   suitable for storing raw data, such as the elements of packed
+   arrays.  */
+
+void *pvm_alloc_atomic (size_t size)
+  __attribute__ ((malloc))
+  __attribute__ ((alloc_size (1)))
+  __attribute__ ((visibility ("hidden")));
+
+/* Allocate the box of a long integer value, i.e. two 64-bit words
+   aligned to 16 bytes.  */
+
+void *pvm_alloc_long (void)
+  __attribute__ ((malloc))
+  __attribute__ ((visibility ("hidden")));
+
 /* Reallocate the given pointer to occupy SIZE bytes and return a
    pointer to the allocated memory.  SIZE has the same semantics as in
    realloc(3).  On error, return NULL.  */
@@ -51,8 +51,28 @@ pvm_make_uint (uint32_t value, int size)
 static inline pvm_val
 pvm_make_long_ulong (int64_t value, int size, int tag)
 {
-  uint64_t *ll = pvm_alloc (sizeof (uint64_t) * 2);
+  uint64_t *ll;
 
+  /* Sign- or zero-extend the value from SIZE bits, so it can be
+     checked whether it fits unboxed.  */
+  if (size < 64)
+    {
+      if (tag == PVM_VAL_TAG_LONG)
+        value = (int64_t) ((uint64_t) value << (64 - size)) >> (64 - size);
+      else
+        value &= ((uint64_t) 1 << size) - 1;
+    }
+
+  if (tag == PVM_VAL_TAG_LONG
+      ? (value >= PVM_LONG_ULONG_INLINE_MIN
+         && value <= PVM_LONG_ULONG_INLINE_MAX)
+      : (uint64_t) value <= PVM_LONG_ULONG_INLINE_MAX)
+    return (((uint64_t) value << 10)
+            | (((size - 1) & 0x3f) << 4)
+            | 0x8
+            | tag);
+
+  ll = pvm_alloc_long ();
   ll[0] = value;
   ll[1] = (size - 1) & 0x3f;
   return ((uint64_t) (uintptr_t) ll) | tag;
@@ -105,6 +125,8 @@ pvm_make_array (pvm_val nelem, pvm_val type)
   arr->nelem = nelem;
   arr->type = type;
   arr->elems = pvm_alloc (nbytes);
+  arr->packed = NULL;
+  arr->lazy = NULL;
 
   for (i = 0; i < PVM_VAL_ULONG (nelem); ++i)
     {
@@ -116,6 +138,326 @@ pvm_make_array (pvm_val nelem, pvm_val type)
   return PVM_BOX (box);
 }
 
+pvm_val
+pvm_make_packed_array (pvm_val nelem, pvm_val type)
+{
+  pvm_val etype = PVM_VAL_TYP_A_ETYPE (type);
+  pvm_val itype = etype;
+  pvm_val unit = PVM_NULL;
+  pvm_val_box box;
+  pvm_array arr;
+  struct pvm_array_packed *packed;
+  size_t nbytes;
+
+  if (PVM_VAL_TYP_CODE (etype) == PVM_TYPE_OFFSET)
+    {
+      itype = PVM_VAL_TYP_O_BASE_TYPE (etype);
+      unit = PVM_VAL_TYP_O_UNIT (etype);
+    }
+  else if (PVM_VAL_TYP_CODE (etype) != PVM_TYPE_INTEGRAL)
+    return pvm_make_array (nelem, type);
+
+  packed = pvm_alloc (sizeof (struct pvm_array_packed));
+  packed->bits = PVM_VAL_INTEGRAL (PVM_VAL_TYP_I_SIZE (itype));
+  packed->signed_p = PVM_VAL_INTEGRAL (PVM_VAL_TYP_I_SIGNED_P (itype));
+  packed->width = PVM_PACKED_WIDTH (packed->bits);
+  packed->unit = unit;
+  nbytes = packed->width * PVM_VAL_ULONG (nelem);
+  packed->values = pvm_alloc_atomic (nbytes);
+  memset (packed->values, 0, nbytes);
+
+  box = pvm_make_box (PVM_VAL_TAG_ARR);
+  arr = pvm_alloc (sizeof (struct pvm_array));
+  arr->ios = PVM_NULL;
+  arr->offset = PVM_NULL;
+  arr->elems_bound = PVM_NULL;
+  arr->size_bound = PVM_NULL;
+  arr->mapper = PVM_NULL;
+  arr->writer = PVM_NULL;
+  arr->nelem = nelem;
+  arr->type = type;
+  arr->elems = NULL;
+  arr->packed = packed;
+  arr->lazy = NULL;
+
+  PVM_VAL_BOX_ARR (box) = arr;
+  return PVM_BOX (box);
+}
+
+pvm_val
+pvm_make_lazy_array (pvm vm, pvm_val ios, pvm_val nelem, pvm_val type,
+                     uint64_t boff, uint64_t esize)
+{
+  pvm_val arr = pvm_make_array (pvm_make_ulong (0, 64), type);
+  struct pvm_array_lazy *lazy = pvm_alloc (sizeof (struct pvm_array_lazy));
+
+  lazy->vm = vm;
+  lazy->ios = ios;
+  lazy->boff = boff;
+  lazy->esize = esize;
+  lazy->nmapped = 0;
+  lazy->next_boff = boff;
+  lazy->nchunks = 0;
+  lazy->chunks = NULL;
+
+  /* The elements are stored in chunks allocated on demand.  */
+  PVM_VAL_ARR (arr)->elems = NULL;
+  PVM_VAL_ARR_NELEM (arr) = nelem;
+  PVM_VAL_ARR_OFFSET (arr) = pvm_make_ulong (boff, 64);
+  PVM_VAL_ARR_LAZY (arr) = lazy;
+  return arr;
+}
+
+/* Return the chunk of the lazy array LAZY containing the element
+   with index IDX, allocating it if it doesn't exist yet.  */
+
+static struct pvm_array_lazy_chunk *
+pvm_lazy_chunk (struct pvm_array_lazy *lazy, uint64_t idx)
+{
+  uint64_t c = idx / PVM_LAZY_CHUNK;
+  struct pvm_array_lazy_chunk *chunk;
+  size_t i;
+
+  if (c >= lazy->nchunks)
+    {
+      size_t nchunks = lazy->nchunks == 0 ? 16 : lazy->nchunks;
+
+      while (nchunks <= c)
+        nchunks *= 2;
+      lazy->chunks = pvm_realloc (lazy->chunks,
+                                  nchunks * sizeof (*lazy->chunks));
+      for (i = lazy->nchunks; i < nchunks; ++i)
+        lazy->chunks[i] = NULL;
+      lazy->nchunks = nchunks;
+    }
+
+  if (lazy->chunks[c] == NULL)
+    {
+      chunk = pvm_alloc (sizeof (struct pvm_array_lazy_chunk));
+      for (i = 0; i < PVM_LAZY_CHUNK; ++i)
+        {
+          chunk->elems[i].offset = PVM_NULL;
+          chunk->elems[i].value = PVM_NULL;
+        }
+      chunk->exception = PVM_NULL;
+      lazy->chunks[c] = chunk;
+    }
+
+  return lazy->chunks[c];
+}
+
+/* Return the storage of the element with index IDX in the array ARR,
+   which is not packed.  */
+
+static struct pvm_array_elem *
+pvm_array_elem (pvm_val arr, uint64_t idx)
+{
+  struct pvm_array_lazy *lazy = PVM_VAL_ARR_LAZY (arr);
+
+  if (lazy == NULL)
+    return &PVM_VAL_ARR_ELEM (arr, idx);
+  return &pvm_lazy_chunk (lazy, idx)->elems[idx % PVM_LAZY_CHUNK];
+}
+
+/* Build the value of an element of a packed array out of its raw
+   magnitude.  */
+
+static pvm_val
+pvm_packed_make_val (struct pvm_array_packed *packed, uint64_t raw)
+{
+  int bits = packed->bits;
+  int64_t value = ((int64_t) (raw << (64 - bits))) >> (64 - bits);
+  pvm_val val;
+
+  if (bits <= 32)
+    val = (packed->signed_p
+           ? pvm_make_int (value, bits) : pvm_make_uint (raw, bits));
+  else
+    val = (packed->signed_p
+           ? pvm_make_long (value, bits) : pvm_make_ulong (raw, bits));
+
+  if (packed->unit != PVM_NULL)
+    val = pvm_make_offset (val, packed->unit);
+
+  return val;
+}
+
+/* If VAL can be stored in the packed array PACKED, put its raw
+   magnitude in *RAW and return 1.  Otherwise return 0.  */
+
+static int
+pvm_packed_raw_val (struct pvm_array_packed *packed, pvm_val val,
+                    uint64_t *raw)
+{
+  int bits = packed->bits;
+  pvm_val mag = val;
+  int size;
+
+  if (packed->unit != PVM_NULL)
+    {
+      if (!PVM_IS_OFF (val)
+          || (PVM_VAL_ULONG (PVM_VAL_OFF_UNIT (val))
+              != PVM_VAL_ULONG (packed->unit)))
+        return 0;
+      mag = PVM_VAL_OFF_MAGNITUDE (val);
+    }
+
+  if (bits <= 32)
+    {
+      if (packed->signed_p ? !PVM_IS_INT (mag) : !PVM_IS_UINT (mag))
+        return 0;
+      size = (PVM_IS_INT (mag)
+              ? PVM_VAL_INT_SIZE (mag) : PVM_VAL_UINT_SIZE (mag));
+    }
+  else
+    {
+      if (packed->signed_p ? !PVM_IS_LONG (mag) : !PVM_IS_ULONG (mag))
+        return 0;
+      size = (PVM_IS_LONG (mag)
+              ? PVM_VAL_LONG_SIZE (mag) : PVM_VAL_ULONG_SIZE (mag));
+    }
+
+  if (size != bits)
+    return 0;
+
+  *raw = (uint64_t) PVM_VAL_INTEGRAL (mag);
+  if (bits < 64)
+    *raw &= ((uint64_t) 1 << bits) - 1;
+  return 1;
+}
+
+uint64_t
+pvm_array_packed_raw (pvm_val arr, uint64_t idx)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+
+  switch (packed->width)
+    {
+    case 1: return ((uint8_t *) packed->values)[idx];
+    case 2: return ((uint16_t *) packed->values)[idx];
+    case 4: return ((uint32_t *) packed->values)[idx];
+    default: return ((uint64_t *) packed->values)[idx];
+    }
+}
+
+void
+pvm_array_set_packed_raw (pvm_val arr, uint64_t idx, uint64_t raw)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+
+  switch (packed->width)
+    {
+    case 1: ((uint8_t *) packed->values)[idx] = raw; break;
+    case 2: ((uint16_t *) packed->values)[idx] = raw; break;
+    case 4: ((uint32_t *) packed->values)[idx] = raw; break;
+    default: ((uint64_t *) packed->values)[idx] = raw; break;
+    }
+}
+
+/* Turn the packed array ARR into a regular array.  */
+
+static void
+pvm_array_unpack (pvm_val arr)
+{
+  size_t i, nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  struct pvm_array_elem *elems
+    = pvm_alloc (sizeof (struct pvm_array_elem) * nelem);
+
+  for (i = 0; i < nelem; ++i)
+    {
+      elems[i].value = pvm_array_elem_value (arr, i);
+      elems[i].offset = pvm_array_elem_offset (arr, i);
+    }
+
+  PVM_VAL_ARR (arr)->elems = elems;
+  PVM_VAL_ARR_PACKED (arr) = NULL;
+}
+
+pvm_val
+pvm_array_elem_value (pvm_val arr, uint64_t idx)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+
+  if (packed == NULL)
+    {
+      /* If the element can't be mapped it is left as PVM_NULL.  The
+         exception is recorded in the array.  */
+      if (PVM_VAL_ARR_LAZY (arr) != NULL)
+        (void) pvm_array_map_elem (arr, idx);
+      return pvm_array_elem (arr, idx)->value;
+    }
+
+  return pvm_packed_make_val (packed, pvm_array_packed_raw (arr, idx));
+}
+
+pvm_val
+pvm_array_elem_offset (pvm_val arr, uint64_t idx)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+
+  if (packed == NULL)
+    {
+      struct pvm_array_lazy *lazy = PVM_VAL_ARR_LAZY (arr);
+
+      if (lazy != NULL && pvm_array_elem (arr, idx)->offset == PVM_NULL)
+        {
+          if (lazy->esize != 0)
+            return pvm_make_ulong (lazy->boff + idx * lazy->esize, 64);
+          (void) pvm_array_map_elem (arr, idx);
+        }
+      return pvm_array_elem (arr, idx)->offset;
+    }
+
+  /* The elements of packed arrays are contiguous, so their offsets
+     follow from the offset of the array.  */
+  if (PVM_VAL_ARR_OFFSET (arr) == PVM_NULL)
+    return pvm_make_ulong (idx * packed->bits, 64);
+  return pvm_make_ulong (PVM_VAL_ULONG (PVM_VAL_ARR_OFFSET (arr))
+                         + idx * packed->bits, 64);
+}
+
+void
+pvm_array_set_elem_value (pvm_val arr, uint64_t idx, pvm_val val)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+
+  if (packed != NULL)
+    {
+      uint64_t raw;
+
+      if (pvm_packed_raw_val (packed, val, &raw))
+        {
+          pvm_array_set_packed_raw (arr, idx, raw);
+          return;
+        }
+      pvm_array_unpack (arr);
+    }
+
+  /* The elements of lazy arrays of variable-size elements shall be
+     mapped in order, so the elements preceding the one being set must
+     be mapped first.  */
+  if (PVM_VAL_ARR_LAZY (arr) != NULL && PVM_VAL_ARR_LAZY_ESIZE (arr) == 0)
+    (void) pvm_array_map_elem (arr, idx);
+
+  pvm_array_elem (arr, idx)->value = val;
+}
+
+void
+pvm_array_set_elem_offset (pvm_val arr, uint64_t idx, pvm_val boff)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+
+  if (packed != NULL)
+    {
+      /* Offsets that follow from the packed layout need no storage.  */
+      if (pvm_val_equal_p (boff, pvm_array_elem_offset (arr, idx)))
+        return;
+      pvm_array_unpack (arr);
+    }
+
+  pvm_array_elem (arr, idx)->offset = boff;
+}
+
 pvm_val
 pvm_make_struct (pvm_val nfields, pvm_val nmethods, pvm_val type)
 {
@@ -337,15 +679,18 @@ pvm_make_cls (pvm_program program)
 pvm_val
 pvm_make_offset (pvm_val magnitude, pvm_val unit)
 {
-  pvm_val_box box = pvm_make_box (PVM_VAL_TAG_OFF);
-  pvm_off off = pvm_alloc (sizeof (struct pvm_off));
-
-  off->base_type = pvm_typeof (magnitude);
-  off->magnitude = magnitude;
-  off->unit = unit;
-
-  PVM_VAL_BOX_OFF (box) = off;
-  return PVM_BOX (box);
+  struct
+  {
+    struct pvm_val_box box;
+    struct pvm_off off;
+  } *boxed_off = pvm_alloc (sizeof (*boxed_off));
+
+  boxed_off->off.magnitude = magnitude;
+  boxed_off->off.unit = unit;
+
+  PVM_VAL_BOX_TAG (&boxed_off->box) = PVM_VAL_TAG_OFF;
+  PVM_VAL_BOX_OFF (&boxed_off->box) = &boxed_off->off;
+  return PVM_BOX (&boxed_off->box);
 }
 
 int
@@ -466,12 +811,12 @@ pvm_val_equal_p (pvm_val val1, pvm_val val2)
 
       for (size_t i = 0 ; i < pvm_arr1_nelems ; i++)
         {
-          if (!pvm_val_equal_p (PVM_VAL_ARR_ELEM_VALUE (val1, i),
-                                PVM_VAL_ARR_ELEM_VALUE (val2, i)))
+          if (!pvm_val_equal_p (pvm_array_elem_value (val1, i),
+                                pvm_array_elem_value (val2, i)))
             return 0;
 
-          if (!pvm_val_equal_p (PVM_VAL_ARR_ELEM_OFFSET (val1, i),
-                                PVM_VAL_ARR_ELEM_OFFSET (val2, i)))
+          if (!pvm_val_equal_p (pvm_array_elem_offset (val1, i),
+                                pvm_array_elem_offset (val2, i)))
             return 0;
         }
 
@@ -565,8 +910,28 @@ pvm_sizeof (pvm_val val)
       size_t size = 0;
 
       nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+      if (PVM_VAL_ARR_PACKED (val) != NULL)
+        return nelem * PVM_VAL_ARR_PACKED_BITS (val);
+
+      if (PVM_VAL_ARR_LAZY (val) != NULL)
+        {
+          if (PVM_VAL_ARR_LAZY_ESIZE (val) != 0)
+            return nelem * PVM_VAL_ARR_LAZY_ESIZE (val);
+
+          /* If some element can't be mapped, the exception is
+             recorded in the array and only the elements preceding it
+             are accounted for.  */
+          if (pvm_array_map_all (val) != PVM_NULL)
+            nelem = PVM_VAL_ARR_LAZY (val)->nmapped;
+        }
+
       for (i = 0; i < nelem; ++i)
-        size += pvm_sizeof (PVM_VAL_ARR_ELEM_VALUE (val, i));
+        {
+          pvm_val elem_value = pvm_array_elem_value (val, i);
+
+          if (elem_value != PVM_NULL)
+            size += pvm_sizeof (elem_value);
+        }
 
       return size;
     }
@@ -946,7 +1311,11 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
       pk_puts ("[");
       for (idx = 0; idx < nelem; idx++)
         {
-          pvm_val elem_value = PVM_VAL_ARR_ELEM_VALUE (val, idx);
+          /* Stop at the first element of a lazy array that can't be
+             mapped.  The exception is raised after printing.  */
+          if (PVM_VAL_ARR_LAZY (val) != NULL
+              && pvm_array_map_elem (val, idx) != PVM_NULL)
+            break;
 
           if (idx != 0)
             pk_puts (",");
@@ -959,7 +1328,7 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
               break;
             }
 
-          PVM_PRINT_VAL_1 (elem_value, ndepth);
+          PVM_PRINT_VAL_1 (pvm_array_elem_value (val, idx), ndepth);
         }
       pk_puts ("]");
 
@@ -1290,6 +1659,128 @@ pvm_print_string (pvm_val string)
   pk_puts (PVM_VAL_STR (string));
 }
 
+/* Number of bytes shown in every line of a dump, and maximum number
+   of bytes read from the IO space at a time.  */
+
+#define PVM_DUMP_LINE 16
+#define PVM_DUMP_CHUNK (4096 * PVM_DUMP_LINE)
+
+static const char pvm_dump_hex[] = "0123456789abcdef";
+
+/* Print a line of a dump, showing the LEN bytes in DATA, located at
+   OFFSET.  */
+
+static void
+pvm_print_dump_line (uint64_t offset, const uint8_t *data, size_t len,
+                     uint64_t group_by, uint64_t cluster, int ascii)
+{
+  /* Every byte takes two digits, plus a separator before every group
+     and after every cluster.  */
+  char line[PVM_DUMP_LINE * 4 + 3];
+  char text[PVM_DUMP_LINE * 2 + 1];
+  char *p = line;
+  size_t o;
+
+  pk_term_class ("dump-address");
+  pk_printf ("%08" PRIx32 ":", (uint32_t) offset);
+  pk_term_end_class ("dump-address");
+
+  for (o = 0; o < PVM_DUMP_LINE; ++o)
+    {
+      if (o >= len && !ascii)
+        break;
+
+      if (o % group_by == 0)
+        *p++ = ' ';
+      if (o < len)
+        {
+          *p++ = pvm_dump_hex[data[o] >> 4];
+          *p++ = pvm_dump_hex[data[o] & 0xf];
+        }
+      else
+        {
+          /* Align the ASCII column of the last line.  */
+          *p++ = ' ';
+          *p++ = ' ';
+        }
+      if (o + 1 < PVM_DUMP_LINE && cluster != 0 && (o + 1) % cluster == 0)
+        *p++ = ' ';
+    }
+  *p = '\0';
+  pk_puts (line);
+
+  if (ascii)
+    {
+      p = text;
+      for (o = 0; o < len; ++o)
+        {
+          *p++ = (data[o] < ' ' || data[o] > '~') ? '.' : data[o];
+          if (o + 1 < PVM_DUMP_LINE && cluster != 0 && (o + 1) % cluster == 0)
+            *p++ = ' ';
+        }
+      *p = '\0';
+
+      pk_puts ("  ");
+      pk_term_class ("dump-ascii");
+      pk_puts (text);
+      pk_term_end_class ("dump-ascii");
+    }
+
+  pk_puts ("\n");
+}
+
+int
+pvm_print_ios_dump (ios io, uint64_t from, uint64_t top,
+                    uint64_t group_by, int cluster_by, int ascii)
+{
+  uint64_t cluster;
+  uint64_t offset = from;
+  uint8_t *buf;
+  int ret = IOS_OK;
+
+  if (group_by == 0)
+    group_by = 1;
+  cluster = cluster_by > 0 ? cluster_by * group_by : 0;
+
+  buf = malloc (PVM_DUMP_CHUNK);
+  if (buf == NULL)
+    return IOS_ENOMEM;
+
+  while (offset < top)
+    {
+      size_t count = (top - offset < PVM_DUMP_CHUNK
+                      ? top - offset : PVM_DUMP_CHUNK);
+      size_t i;
+
+      ret = ios_read_bytes (io, offset * 8, 0, count, buf);
+      if (ret == IOS_EIOFF)
+        {
+          /* Dump whatever is available before the end of the IO
+             space.  */
+          for (i = 0; i < count; ++i)
+            if (ios_read_bytes (io, (offset + i) * 8, 0, 1,
+                                buf + i) != IOS_OK)
+              break;
+          count = i;
+        }
+      else if (ret != IOS_OK)
+        break;
+
+      for (i = 0; i < count; i += PVM_DUMP_LINE)
+        pvm_print_dump_line (offset + i, buf + i,
+                             (count - i < PVM_DUMP_LINE
+                              ? count - i : PVM_DUMP_LINE),
+                             group_by, cluster, ascii);
+
+      if (ret != IOS_OK)
+        break;
+      offset += count;
+    }
+
+  free (buf);
+  return ret;
+}
+
 /* Call a struct pretty-print function in the closure CLS,
    corresponding to the struct VAL.  */
 
@@ -1322,6 +1813,253 @@ pvm_call_pretty_printer (pvm vm, pvm_val val)
   return 1;
 }
 
+/* Map NELEM elements of the lazy array ARR starting at the bit offset
+   BOFF, by calling the mapper of the array in a new program.  Lazy
+   mapping is disabled while the mapper runs, so the result is a
+   regular array.  Return either that array or the exception raised
+   by the mapper.  */
+
+static pvm_val
+pvm_array_call_mapper (pvm_val arr, uint64_t boff, uint64_t nelem)
+{
+  pvm vm = PVM_VAL_ARR_LAZY (arr)->vm;
+  pvm_val mapper = PVM_VAL_ARR_MAPPER (arr);
+  pvm_val res = PVM_NULL;
+  pvm_program_label handler, done;
+  pvm_program program;
+  pkl_asm pasm;
+  int lazy_map;
+
+  if (mapper == PVM_NULL || pvm_compiler (vm) == NULL)
+    return pvm_make_exception (PVM_E_GENERIC, PVM_E_GENERIC_MSG,
+                               PVM_E_GENERIC_ESTATUS);
+
+  pasm = pkl_asm_new (NULL /* ast */,
+                      pvm_compiler (vm), 1 /* prologue */);
+  handler = pkl_asm_fresh_label (pasm);
+  done = pkl_asm_fresh_label (pasm);
+
+  /* Any exception raised by the mapper becomes the result of the
+     program.  */
+  pkl_asm_insn (pasm, PKL_INSN_PUSH,
+                pvm_make_exception (PVM_E_GENERIC, PVM_E_GENERIC_MSG,
+                                    PVM_E_GENERIC_ESTATUS));
+  pkl_asm_insn (pasm, PKL_INSN_PUSHE, handler);
+
+  /* Call the mapper.  */
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, PVM_VAL_ARR_LAZY (arr)->ios);
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_ulong (boff, 64));
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_ulong (nelem, 64));
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, PVM_NULL);
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, mapper);
+  pkl_asm_insn (pasm, PKL_INSN_CALL);
+
+  pkl_asm_insn (pasm, PKL_INSN_POPE);
+  pkl_asm_insn (pasm, PKL_INSN_BA, done);
+  pkl_asm_label (pasm, handler);
+  pkl_asm_label (pasm, done);
+
+  /* Run the program in the poke VM.  */
+  program = pkl_asm_finish (pasm, 1 /* epilogue */);
+  pvm_program_make_executable (program);
+
+  lazy_map = pvm_lazy_map (vm);
+  pvm_set_lazy_map (vm, 0);
+  if (pvm_run (vm, program, &res) != PVM_EXIT_OK)
+    res = PVM_NULL;
+  pvm_set_lazy_map (vm, lazy_map);
+  pvm_destroy_program (program);
+
+  if (res == PVM_NULL)
+    res = pvm_make_exception (PVM_E_GENERIC, PVM_E_GENERIC_MSG,
+                              PVM_E_GENERIC_ESTATUS);
+  return res;
+}
+
+pvm_val
+pvm_array_map_elem (pvm_val arr, uint64_t idx)
+{
+  struct pvm_array_lazy *lazy = PVM_VAL_ARR_LAZY (arr);
+  struct pvm_array_lazy_chunk *lchunk;
+  uint64_t nelem, first, count, boff, i;
+  pvm_val chunk = PVM_NULL;
+
+  if (lazy == NULL)
+    return PVM_NULL;
+
+  lchunk = pvm_lazy_chunk (lazy, idx);
+  if (lchunk->elems[idx % PVM_LAZY_CHUNK].value != PVM_NULL)
+    return PVM_NULL;
+
+  nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+
+  if (lazy->esize != 0)
+    {
+      /* Map the chunk containing the element.  */
+      first = idx - idx % PVM_LAZY_CHUNK;
+      boff = lazy->boff + first * lazy->esize;
+      count = PVM_LAZY_CHUNK;
+    }
+  else
+    {
+      /* Map the elements following the ones already mapped, up to
+         the requested element.  */
+      first = lazy->nmapped;
+      boff = lazy->next_boff;
+      count = idx + 1 - first;
+      if (count < PVM_LAZY_CHUNK)
+        count = PVM_LAZY_CHUNK;
+    }
+
+  if (count > nelem - first)
+    count = nelem - first;
+
+  /* If some element in the chunk can't be mapped, map just the
+     requested element, or the elements up to it if their size
+     varies, so the error doesn't extend to other elements.  */
+  if (lchunk->exception == PVM_NULL)
+    chunk = pvm_array_call_mapper (arr, boff, count);
+  if (chunk == PVM_NULL || !PVM_IS_ARR (chunk))
+    {
+      if (lazy->esize != 0)
+        {
+          first = idx;
+          boff = lazy->boff + idx * lazy->esize;
+          count = 1;
+        }
+      else
+        count = idx + 1 - first;
+
+      chunk = pvm_array_call_mapper (arr, boff, count);
+      if (!PVM_IS_ARR (chunk))
+        {
+          lchunk->exception = chunk;
+          return chunk;
+        }
+    }
+
+  /* Note that elements that were set since the array was mapped keep
+     their values.  */
+  for (i = 0; i < count; ++i)
+    {
+      struct pvm_array_elem *elem = pvm_array_elem (arr, first + i);
+
+      if (elem->value == PVM_NULL)
+        elem->value = PVM_VAL_ARR_ELEM_VALUE (chunk, i);
+      if (elem->offset == PVM_NULL)
+        elem->offset = PVM_VAL_ARR_ELEM_OFFSET (chunk, i);
+    }
+
+  if (lazy->esize == 0)
+    {
+      lazy->nmapped = first + count;
+      lazy->next_boff = boff + pvm_sizeof (chunk);
+    }
+
+  return PVM_NULL;
+}
+
+pvm_val
+pvm_array_map_all (pvm_val arr)
+{
+  struct pvm_array_elem *elems;
+  uint64_t nelem, idx;
+
+  if (PVM_VAL_ARR_LAZY (arr) == NULL)
+    return PVM_NULL;
+
+  nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  for (idx = 0; idx < nelem; ++idx)
+    {
+      pvm_val exception = pvm_array_map_elem (arr, idx);
+
+      if (exception != PVM_NULL)
+        return exception;
+    }
+
+  /* Move the elements out of the chunks.  Offsets of unmapped
+     elements of fixed size are not stored.  */
+  elems = pvm_alloc (sizeof (struct pvm_array_elem) * nelem);
+  for (idx = 0; idx < nelem; ++idx)
+    {
+      elems[idx] = *pvm_array_elem (arr, idx);
+      if (elems[idx].offset == PVM_NULL)
+        elems[idx].offset = pvm_array_elem_offset (arr, idx);
+    }
+
+  PVM_VAL_ARR (arr)->elems = elems;
+  PVM_VAL_ARR_LAZY (arr) = NULL;
+  return PVM_NULL;
+}
+
+pvm_val
+pvm_val_lazy_exception (pvm_val val)
+{
+  pvm_val exception;
+  size_t nelem, i;
+
+  if (PVM_IS_ARR (val))
+    {
+      struct pvm_array_lazy *lazy = PVM_VAL_ARR_LAZY (val);
+
+      if (PVM_VAL_ARR_PACKED (val) != NULL)
+        return PVM_NULL;
+
+      /* Only the elements in the allocated chunks of lazy arrays may
+         have been mapped.  */
+      if (lazy != NULL)
+        {
+          size_t c;
+
+          for (c = 0; c < lazy->nchunks; ++c)
+            {
+              struct pvm_array_lazy_chunk *chunk = lazy->chunks[c];
+
+              if (chunk == NULL)
+                continue;
+              if (chunk->exception != PVM_NULL)
+                return chunk->exception;
+
+              for (i = 0; i < PVM_LAZY_CHUNK; ++i)
+                {
+                  pvm_val elem_value = chunk->elems[i].value;
+
+                  if (elem_value != PVM_NULL
+                      && ((exception = pvm_val_lazy_exception (elem_value))
+                          != PVM_NULL))
+                    return exception;
+                }
+            }
+
+          return PVM_NULL;
+        }
+
+      nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+      for (i = 0; i < nelem; ++i)
+        {
+          pvm_val elem_value = PVM_VAL_ARR_ELEM_VALUE (val, i);
+
+          if (elem_value != PVM_NULL
+              && (exception = pvm_val_lazy_exception (elem_value)) != PVM_NULL)
+            return exception;
+        }
+    }
+  else if (PVM_IS_SCT (val))
+    {
+      nelem = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (val));
+      for (i = 0; i < nelem; ++i)
+        {
+          pvm_val field_value = PVM_VAL_SCT_FIELD_VALUE (val, i);
+
+          if (field_value != PVM_NULL
+              && (exception = pvm_val_lazy_exception (field_value)) != PVM_NULL)
+            return exception;
+        }
+    }
+
+  return PVM_NULL;
+}
+
 /* IMPORTANT: please keep pvm_make_exception in sync with the
    definition of the struct Exception in pkl-rt.pk.  */
 
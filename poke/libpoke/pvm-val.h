@@ -45,7 +45,11 @@
 #define PVM_VAL_TAG_TYP 0xc
 #define PVM_VAL_TAG_CLS 0xd
 
-#define PVM_VAL_BOXED_P(V) (PVM_VAL_TAG((V)) > 1)
+#define PVM_VAL_BOXED_P(V)                                      \
+  (PVM_VAL_TAG((V)) > 1                                         \
+   && !((PVM_VAL_TAG((V)) == PVM_VAL_TAG_LONG                   \
+         || PVM_VAL_TAG((V)) == PVM_VAL_TAG_ULONG)              \
+        && PVM_VAL_LONG_ULONG_INLINE_P ((V))))
 
 /* Integers up to 32-bit are unboxed and encoded the following way:
 
@@ -70,11 +74,23 @@
 
 #define PVM_MAX_UINT(size) ((1U << (size)) - 1)
 
-/* Long integers, wider than 32-bit and up to 64-bit, are boxed.  A
-   pointer
+/* Long integers, wider than 32-bit and up to 64-bit, are unboxed if
+   their value fits in 54 bits as a signed number, and encoded the
+   following way:
+
+              val                                bits    tag
+              ---                                ----    ---
+      vvvv vvvv ... vvvv vvvv vvvv vvvv vvvv vvbb bbbb 1ttt
+
+   BITS+1 is the size of the integral value in bits, from 0 to 63.
+
+   VAL is the value of the integer, sign-extended to 54 bits.
+
+   Otherwise they are boxed.  A pointer
+
                                              tag
                                              ---
-         pppp pppp pppp pppp pppp pppp pppp pttt
+         pppp pppp pppp pppp pppp pppp pppp 0ttt
 
    points to a pair of 64-bit words:
 
@@ -88,10 +104,25 @@
    BITS+1 is the size of the integral value in bits, from 0 to 63.
 
    VAL is the value of the integer, sign- or zero-extended to 64 bits.
-   Bits marked with `x' are unused.  */
-
-#define _PVM_VAL_LONG_ULONG_VAL(V) (((int64_t *) ((((uintptr_t) V) & ~0x7)))[0])
-#define _PVM_VAL_LONG_ULONG_SIZE(V) ((int) (((int64_t *) ((((uintptr_t) V) & ~0x7)))[1]) + 1)
+   Bits marked with `x' are unused.
+
+   Boxed long integers are allocated at 16-byte boundaries, so the
+   fourth bit of the pointer is always zero and tells apart both
+   encodings.  Note that most long integers, like the bit-offsets
+   handled by mappers, are unboxed.  */
+
+#define PVM_VAL_LONG_ULONG_INLINE_P(V) ((V) & 0x8)
+#define PVM_LONG_ULONG_INLINE_MIN (-((int64_t) 1 << 53))
+#define PVM_LONG_ULONG_INLINE_MAX (((int64_t) 1 << 53) - 1)
+
+#define _PVM_VAL_LONG_ULONG_VAL(V)                                      \
+  (PVM_VAL_LONG_ULONG_INLINE_P ((V))                                    \
+   ? ((int64_t) (V)) >> 10                                              \
+   : ((int64_t *) ((((uintptr_t) V) & ~0x7)))[0])
+#define _PVM_VAL_LONG_ULONG_SIZE(V)                                     \
+  (PVM_VAL_LONG_ULONG_INLINE_P ((V))                                    \
+   ? ((int) (((V) >> 4) & 0x3f)) + 1                                    \
+   : ((int) (((int64_t *) ((((uintptr_t) V) & ~0x7)))[1]) + 1))
 
 #define PVM_VAL_LONG_SIZE(V) (_PVM_VAL_LONG_ULONG_SIZE (V))
 #define PVM_VAL_LONG(V) (_PVM_VAL_LONG_ULONG_VAL ((V))           \
@@ -186,7 +217,17 @@ typedef struct pvm_val_box *pvm_val_box;
    NELEM is the number of elements contained in the array.
 
    ELEMS is a list of elements.  The order of the elements is
-   relevant.  */
+   relevant.  This is NULL if the array is packed.
+
+   PACKED holds the elements of packed arrays, and is NULL otherwise.
+   See below for a description of packed arrays.
+
+   LAZY holds the state of lazily mapped arrays, and is NULL
+   otherwise.  See below for a description of lazy arrays.
+
+   Code that may operate on packed arrays shall not use the
+   PVM_VAL_ARR_ELEM* accessors directly, but the pvm_array_elem_*
+   functions declared below.  */
 
 #define PVM_VAL_ARR(V) (PVM_VAL_BOX_ARR (PVM_VAL_BOX ((V))))
 #define PVM_VAL_ARR_IOS(V) (PVM_VAL_ARR(V)->ios)
@@ -198,6 +239,8 @@ typedef struct pvm_val_box *pvm_val_box;
 #define PVM_VAL_ARR_TYPE(V) (PVM_VAL_ARR(V)->type)
 #define PVM_VAL_ARR_NELEM(V) (PVM_VAL_ARR(V)->nelem)
 #define PVM_VAL_ARR_ELEM(V,I) (PVM_VAL_ARR(V)->elems[(I)])
+#define PVM_VAL_ARR_PACKED(V) (PVM_VAL_ARR(V)->packed)
+#define PVM_VAL_ARR_LAZY(V) (PVM_VAL_ARR(V)->lazy)
 
 struct pvm_array
 {
@@ -210,6 +253,8 @@ struct pvm_array
   pvm_val type;
   pvm_val nelem;
   struct pvm_array_elem *elems;
+  struct pvm_array_packed *packed;
+  struct pvm_array_lazy *lazy;
 };
 
 typedef struct pvm_array *pvm_array;
@@ -234,6 +279,106 @@ struct pvm_array_elem
   pvm_val value;
 };
 
+/* Arrays whose elements are integers or offsets can be packed.
+   Packed arrays store the magnitudes of their elements contiguously,
+   as raw native values, instead of an array element per value.  This
+   saves the space of the element offsets and the boxes of the values
+   wider than 32 bits.  The element values and offsets are built on
+   demand when accessed.
+
+   BITS and SIGNED_P describe the integral type of the elements, or
+   the base type of the elements if they are offsets.
+
+   UNIT is an ulong<64> value with the unit of the elements if they
+   are offsets.  It is PVM_NULL if the elements are integers.
+
+   WIDTH is the size in bytes of the magnitudes stored in VALUES.  It
+   is the narrowest of 1, 2, 4 and 8 that can hold BITS bits.
+
+   VALUES contains the magnitudes of the elements, zero-extended to
+   WIDTH bytes.
+
+   The element with index I is located at I * BITS bits from the
+   offset of the array, or from the beginning of the array if it is
+   not mapped.  */
+
+#define PVM_VAL_ARR_PACKED_BITS(V) (PVM_VAL_ARR_PACKED(V)->bits)
+#define PVM_VAL_ARR_PACKED_SIGNED_P(V) (PVM_VAL_ARR_PACKED(V)->signed_p)
+#define PVM_VAL_ARR_PACKED_UNIT(V) (PVM_VAL_ARR_PACKED(V)->unit)
+#define PVM_VAL_ARR_PACKED_WIDTH(V) (PVM_VAL_ARR_PACKED(V)->width)
+#define PVM_VAL_ARR_PACKED_VALUES(V) (PVM_VAL_ARR_PACKED(V)->values)
+
+#define PVM_PACKED_WIDTH(BITS)                          \
+  ((BITS) <= 8 ? 1 : (BITS) <= 16 ? 2 : (BITS) <= 32 ? 4 : 8)
+
+struct pvm_array_packed
+{
+  int bits;
+  int signed_p;
+  int width;
+  pvm_val unit;
+  void *values;
+};
+
+/* Mapped arrays bounded by a number of elements can be mapped lazily.
+   The elements of lazy arrays are not mapped when the array is
+   mapped, but when they are first accessed.  Elements are mapped in
+   chunks of PVM_LAZY_CHUNK elements, by calling the mapper of the
+   array.  Until an element is mapped its value is PVM_NULL.
+
+   The elements of lazy arrays are not stored in ELEMS, which is NULL,
+   but in chunks that are allocated when they are first accessed, so
+   mapping an array takes constant time and space.  The elements are
+   moved to ELEMS once all of them are mapped.
+
+   VM is the virtual machine used to run the mapper of the array.
+
+   IOS is the identifier of the IO space where the array is mapped.
+
+   BOFF is the bit offset of the first element, relative to the
+   beginning of the IO space.
+
+   ESIZE is the size of the elements, in bits, if all the elements
+   have the same size.  In that case the offset of any element can be
+   calculated and elements are mapped in any order.  Otherwise ESIZE
+   is zero and the elements are mapped in order, up to the element
+   being accessed.
+
+   NMAPPED is the number of leading elements that have been mapped,
+   and NEXT_BOFF is the bit offset of the element following these.
+   These are only used if ESIZE is zero.
+
+   CHUNKS is a table of NCHUNKS pointers to the chunks holding the
+   elements, which are NULL until the chunk is first accessed.
+
+   The EXCEPTION of a chunk is the last exception raised by the
+   mapper when an element of the chunk couldn't be mapped, or
+   PVM_NULL.  Code that can't raise exceptions leaves these elements
+   as PVM_NULL, and the exception is raised by the next instruction
+   accessing the array.  */
+
+#define PVM_VAL_ARR_LAZY_ESIZE(V) (PVM_VAL_ARR_LAZY(V)->esize)
+
+#define PVM_LAZY_CHUNK 128
+
+struct pvm_array_lazy_chunk
+{
+  struct pvm_array_elem elems[PVM_LAZY_CHUNK];
+  pvm_val exception;
+};
+
+struct pvm_array_lazy
+{
+  pvm vm;
+  pvm_val ios;
+  uint64_t boff;
+  uint64_t esize;
+  uint64_t nmapped;
+  uint64_t next_boff;
+  size_t nchunks;
+  struct pvm_array_lazy_chunk **chunks;
+};
+
 /* Struct values are boxed, and store collections of named values
    called structure "elements".  They can be mapped in IO, or
    unmapped.
@@ -434,13 +579,18 @@ struct pvm_cls
 
 typedef struct pvm_cls *pvm_cls;
 
-/* Offsets are boxed values.  */
+/* Offsets are boxed values.  The box and the offset are allocated
+   together, and both the magnitude and the unit are usually unboxed
+   integers, so making an offset takes a single allocation.
+
+   The base type of an offset is the type of its magnitude, and it is
+   only built when requested.  */
 
 #define PVM_VAL_OFF(V) (PVM_VAL_BOX_OFF (PVM_VAL_BOX ((V))))
 
 #define PVM_VAL_OFF_MAGNITUDE(V) (PVM_VAL_OFF((V))->magnitude)
 #define PVM_VAL_OFF_UNIT(V) (PVM_VAL_OFF((V))->unit)
-#define PVM_VAL_OFF_BASE_TYPE(V) (PVM_VAL_OFF((V))->base_type)
+#define PVM_VAL_OFF_BASE_TYPE(V) (pvm_typeof (PVM_VAL_OFF_MAGNITUDE ((V))))
 
 #define PVM_VAL_OFF_UNIT_BITS 1
 #define PVM_VAL_OFF_UNIT_NIBBLES 4
@@ -462,7 +612,6 @@ typedef struct pvm_cls *pvm_cls;
 
 struct pvm_off
 {
-  pvm_val base_type;
   pvm_val magnitude;
   pvm_val unit;
 };
@@ -595,4 +744,46 @@ void pvm_allocate_struct_attrs (pvm_val nfields, pvm_val **fnames,
 void pvm_allocate_closure_attrs (pvm_val nargs, pvm_val **atypes)
   __attribute__ ((visibility ("hidden")));
 
+/* Get and set the raw magnitude of the element with index IDX in the
+   packed array ARR.  */
+
+uint64_t pvm_array_packed_raw (pvm_val arr, uint64_t idx)
+  __attribute__ ((visibility ("hidden")));
+void pvm_array_set_packed_raw (pvm_val arr, uint64_t idx, uint64_t raw)
+  __attribute__ ((visibility ("hidden")));
+
+/* Get and set the value and the offset of the element with index IDX
+   in the array ARR.  These work for both packed and non-packed arrays.
+   Setting a value or an offset that can't be represented in a packed
+   array turns it into a regular array.  */
+
+pvm_val pvm_array_elem_value (pvm_val arr, uint64_t idx)
+  __attribute__ ((visibility ("hidden")));
+pvm_val pvm_array_elem_offset (pvm_val arr, uint64_t idx)
+  __attribute__ ((visibility ("hidden")));
+void pvm_array_set_elem_value (pvm_val arr, uint64_t idx, pvm_val val)
+  __attribute__ ((visibility ("hidden")));
+void pvm_array_set_elem_offset (pvm_val arr, uint64_t idx, pvm_val boff)
+  __attribute__ ((visibility ("hidden")));
+
+/* Map the element with index IDX in the lazy array ARR, if it is not
+   mapped yet.  pvm_array_map_all maps all the elements of ARR, which
+   is no longer lazy afterwards.  Both functions do nothing if ARR is
+   not lazy, and return either PVM_NULL or the exception raised while
+   mapping.  When mapping an element fails, the exception is recorded
+   in the chunk of ARR containing it, and other elements can still be
+   mapped.  */
+
+pvm_val pvm_array_map_elem (pvm_val arr, uint64_t idx)
+  __attribute__ ((visibility ("hidden")));
+pvm_val pvm_array_map_all (pvm_val arr)
+  __attribute__ ((visibility ("hidden")));
+
+/* Return the exception recorded in the first chunk of a lazy array
+   contained in VAL, at any depth, whose elements couldn't be mapped.
+   Return PVM_NULL if there is none.  */
+
+pvm_val pvm_val_lazy_exception (pvm_val val)
+  __attribute__ ((visibility ("hidden")));
+
 #endif /* ! PVM_VAL_H */
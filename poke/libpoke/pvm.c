@@ -45,6 +45,8 @@
   ((PVM)->pvm_state.pvm_state_runtime.nenc)
 #define PVM_STATE_PRETTY_PRINT(PVM)                     \
   ((PVM)->pvm_state.pvm_state_runtime.pretty_print)
+#define PVM_STATE_LAZY_MAP(PVM)                         \
+  ((PVM)->pvm_state.pvm_state_runtime.lazy_map)
 #define PVM_STATE_OMODE(PVM)                            \
   ((PVM)->pvm_state.pvm_state_runtime.omode)
 #define PVM_STATE_OBASE(PVM)                            \
@@ -194,6 +196,18 @@ pvm_set_pretty_print (pvm apvm, int flag)
   PVM_STATE_PRETTY_PRINT (apvm) = flag;
 }
 
+int
+pvm_lazy_map (pvm apvm)
+{
+  return PVM_STATE_LAZY_MAP (apvm);
+}
+
+void
+pvm_set_lazy_map (pvm apvm, int flag)
+{
+  PVM_STATE_LAZY_MAP (apvm) = flag;
+}
+
 enum pvm_omode
 pvm_omode (pvm apvm)
 {
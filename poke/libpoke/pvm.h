@@ -252,6 +252,19 @@ pvm_val pvm_make_offset (pvm_val magnitude, pvm_val unit)
 pvm_val pvm_make_array (pvm_val nelem, pvm_val type)
   __attribute__ ((visibility ("hidden")));
 
+/* Make a packed array PVM value.
+
+   NELEM and TYPE are like in pvm_make_array.  If the elements of TYPE
+   are neither integers nor offsets then this is equivalent to
+   pvm_make_array.
+
+   The magnitudes of the elements in the created array are initialized
+   to zero.  The element offsets follow from the offset of the
+   array.  */
+
+pvm_val pvm_make_packed_array (pvm_val nelem, pvm_val type)
+  __attribute__ ((visibility ("hidden")));
+
 /* Make a struct PVM value.
 
    NFIELDS is an ulong<64> PVM value specifying the number of fields
@@ -286,6 +299,20 @@ int pvm_val_equal_p (pvm_val val1, pvm_val val2)
 void pvm_print_string (pvm_val string)
   __attribute__ ((visibility ("hidden")));
 
+/* Print a hexadecimal dump of the bytes in the range [FROM, TOP) of
+   the IO space IO, sixteen bytes per line.  The bytes in every line
+   are separated in groups of GROUP_BY bytes, and the groups in
+   clusters of CLUSTER_BY groups.  If ASCII is not zero, the bytes
+   are also shown as ASCII characters.
+
+   Return IOS_OK on success.  If the IO space ends before TOP, print
+   the available data and return IOS_EIOFF.  Return any other IOS
+   error code otherwise.  */
+
+int pvm_print_ios_dump (ios io, uint64_t from, uint64_t top,
+                        uint64_t group_by, int cluster_by, int ascii)
+  __attribute__ ((visibility ("hidden")));
+
 pvm_val pvm_ref_struct (pvm_val sct, pvm_val name)
   __attribute__ ((visibility ("hidden")));
 
@@ -602,6 +629,19 @@ int pvm_pretty_print (pvm pvm)
 void pvm_set_pretty_print (pvm pvm, int pretty_print_p)
   __attribute__ ((visibility ("hidden")));
 
+/* Get/set the lazy-map flag in a virtual machine.
+
+   LAZY_MAP_P is a boolean indicating whether to map the elements of
+   arrays bounded by a number of elements when they are first
+   accessed, instead of when the array is mapped.  This requires the
+   presence of a compiler associated with the VM.  */
+
+int pvm_lazy_map (pvm pvm)
+  __attribute__ ((visibility ("hidden")));
+
+void pvm_set_lazy_map (pvm pvm, int lazy_map_p)
+  __attribute__ ((visibility ("hidden")));
+
 /* Get/set the output parameters configured in a virtual machine.
 
    OBASE is the numeration based to be used when printing PVM values.
@@ -690,6 +730,20 @@ void pvm_handle_signal (int signal_number)
 int pvm_call_pretty_printer (pvm vm, pvm_val val)
   __attribute__ ((visibility ("hidden")));
 
+/* Make a lazy array PVM value.
+
+   NELEM and TYPE are like in pvm_make_array.  IOS is the identifier
+   of the IO space where the array is mapped.  BOFF is the bit offset
+   of the first element, and ESIZE is either the size of every element
+   in bits or zero if the elements vary in size.  VM is the virtual
+   machine used to map the elements when they are accessed.
+
+   The mapper of the array shall be set by the caller.  */
+
+pvm_val pvm_make_lazy_array (pvm vm, pvm_val ios, pvm_val nelem,
+                             pvm_val type, uint64_t boff, uint64_t esize)
+  __attribute__ ((visibility ("hidden")));
+
 /* Print a PVM value.
 
    DEPTH is a number that specifies the maximum depth used when
@@ -23,6 +23,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <readline.h>
 #include "xalloc.h"
 
@@ -106,7 +107,7 @@ pk_cmd_close (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
 {
   /* close [#ID]  */
   pk_ios io;
-  int changed;
+  int changed, ret = 1;
 
   assert (argc == 1);
 
@@ -125,7 +126,14 @@ pk_cmd_close (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
     }
 
   changed = (io == pk_ios_cur (poke_compiler));
-  pk_ios_close (poke_compiler, io);
+  if (pk_ios_close (poke_compiler, io) != PK_IOS_OK)
+    {
+      pk_term_class ("error");
+      pk_puts ("error: ");
+      pk_term_end_class ("error");
+      pk_puts (_("the contents of the IO space could not be written back.\n"));
+      ret = 0;
+    }
 
   if (changed)
     {
@@ -139,7 +147,7 @@ pk_cmd_close (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
         }
     }
 
-  return 1;
+  return ret;
 }
 
 static void
@@ -176,6 +184,9 @@ print_info_ios (pk_ios io, void *data)
 #endif
   pk_puts ("\t");
 
+  pk_printf ("%" PRIu64 "\t%" PRIu64 "\t",
+             pk_ios_cache_hits (io), pk_ios_cache_misses (io));
+
 #if HAVE_HSERVER
   {
     char *cmd;
@@ -203,7 +214,7 @@ pk_cmd_info_ios (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
 {
   assert (argc == 0);
 
-  pk_printf (_("  Id\tMode\tSize\t\tName\n"));
+  pk_printf (_("  Id\tMode\tSize\t\tHits\tMisses\tName\n"));
   pk_ios_map (poke_compiler, print_info_ios, NULL);
 
   return 1;
@@ -333,6 +344,276 @@ pk_cmd_nbd (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
 }
 #endif /* HAVE_LIBNBD */
 
+/* Return the IO space denoted by the optional #ID argument ARG, or
+   the current IO space if ARG is null.  Print an error message and
+   return NULL if there is no such IO space.  */
+
+static pk_ios
+overlay_arg_ios (struct pk_cmd_arg arg)
+{
+  pk_ios io;
+
+  if (PK_CMD_ARG_TYPE (arg) == PK_CMD_ARG_NULL)
+    return pk_ios_cur (poke_compiler);
+
+  io = pk_ios_search_by_id (poke_compiler, PK_CMD_ARG_TAG (arg));
+  if (io == NULL)
+    pk_printf (_("No such IO space #%d\n"), (int) PK_CMD_ARG_TAG (arg));
+  return io;
+}
+
+static int
+pk_cmd_overlay_open (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* overlay open #ID */
+
+  char *handler;
+  int ret = 1;
+
+  assert (argc == 1);
+  assert (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_TAG);
+
+  if (pk_ios_search_by_id (poke_compiler, PK_CMD_ARG_TAG (argv[0])) == NULL)
+    {
+      pk_printf (_("No such IO space #%d\n"), (int) PK_CMD_ARG_TAG (argv[0]));
+      return 0;
+    }
+
+  if (asprintf (&handler, "overlay://%d", (int) PK_CMD_ARG_TAG (argv[0])) == -1)
+    pk_fatal ("out of memory");
+
+  if (PK_IOS_ERROR == pk_ios_open (poke_compiler, handler, 0, 1))
+    {
+      pk_printf (_("Error creating overlay IOS %s\n"), handler);
+      ret = 0;
+    }
+  else if (poke_interactive_p && !poke_quiet_p)
+    pk_printf (_("The current IOS is now `%s'.\n"),
+               pk_ios_handler (pk_ios_cur (poke_compiler)));
+
+  free (handler);
+  return ret;
+}
+
+static int
+pk_cmd_overlay_commit (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* overlay commit [#ID] */
+
+  pk_ios io;
+
+  assert (argc == 1);
+
+  io = overlay_arg_ios (argv[0]);
+  if (io == NULL)
+    return 0;
+
+  if (pk_ios_overlay_commit (poke_compiler, io) != PK_IOS_OK)
+    {
+      pk_printf (_("Error committing IOS %s\n"), pk_ios_handler (io));
+      return 0;
+    }
+
+  return 1;
+}
+
+static int
+pk_cmd_overlay_discard (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* overlay discard [#ID] */
+
+  pk_ios io;
+
+  assert (argc == 1);
+
+  io = overlay_arg_ios (argv[0]);
+  if (io == NULL)
+    return 0;
+
+  if (pk_ios_overlay_discard (poke_compiler, io) != PK_IOS_OK)
+    {
+      pk_printf (_("Error discarding IOS %s\n"), pk_ios_handler (io));
+      return 0;
+    }
+
+  return 1;
+}
+
+static void
+print_overlay_extent (pk_ios io, uint64_t offset, uint64_t size, void *data)
+{
+  pk_printf ("  0x%08jx#B\t0x%jx#B\n",
+             (uintmax_t) (offset / 8), (uintmax_t) (size / 8));
+}
+
+static int
+pk_cmd_overlay_diff (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* overlay diff [#ID] */
+
+  pk_ios io;
+
+  assert (argc == 1);
+
+  io = overlay_arg_ios (argv[0]);
+  if (io == NULL)
+    return 0;
+
+  pk_puts (_("  Offset\t\tSize\n"));
+  if (pk_ios_overlay_map (poke_compiler, io, print_overlay_extent,
+                          NULL) != PK_IOS_OK)
+    {
+      pk_printf (_("IOS %s is not an overlay\n"), pk_ios_handler (io));
+      return 0;
+    }
+
+  return 1;
+}
+
+/* Return the value of the field named NAME of the struct SCT, or
+   PK_NULL if there is no such field.  */
+
+static pk_val
+diff_struct_field (pk_val sct, const char *name)
+{
+  uint64_t nfields = pk_uint_value (pk_struct_nfields (sct));
+  uint64_t i;
+
+  for (i = 0; i < nfields; ++i)
+    {
+      pk_val fname = pk_struct_field_name (sct, i);
+
+      if (fname != PK_NULL && strcmp (pk_string_str (fname), name) == 0)
+        return pk_struct_field_value (sct, i);
+    }
+
+  return PK_NULL;
+}
+
+/* Map a value of TYPE at the beginning of the IO space IO.  Return
+   PK_NULL if that is not possible.  */
+
+static pk_val
+diff_map_type (pk_ios io, const char *type)
+{
+  pk_val val;
+  char *exp;
+
+  if (asprintf (&exp, "%s @ %d : 0#B", type, pk_ios_get_id (io)) == -1)
+    return PK_NULL;
+
+  if (!pk_compile_expression (poke_compiler, exp, NULL, &val))
+    val = PK_NULL;
+  free (exp);
+
+  if (val != PK_NULL && pk_type_code (pk_typeof (val)) != PK_STRUCT)
+    {
+      pk_printf (_("`%s' is not a struct type\n"), type);
+      val = PK_NULL;
+    }
+
+  return val;
+}
+
+static int
+pk_cmd_diff (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* diff #ID1, #ID2 [,TYPE] */
+
+  pk_ios io1, io2;
+  pk_val extents;
+  uint64_t size, nelem, i;
+  char *exp;
+  int ret;
+
+  assert (argc == 3);
+  assert (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_TAG);
+  assert (PK_CMD_ARG_TYPE (argv[1]) == PK_CMD_ARG_TAG);
+
+  io1 = overlay_arg_ios (argv[0]);
+  io2 = overlay_arg_ios (argv[1]);
+  if (io1 == NULL || io2 == NULL)
+    return 0;
+
+  if (PK_CMD_ARG_TYPE (argv[2]) == PK_CMD_ARG_STR)
+    {
+      /* Show the fields of a struct mapped at the beginning of both
+         IO spaces whose values differ.  Note that differences past
+         the struct are not reported in this form.  */
+      const char *type = PK_CMD_ARG_STR (argv[2]);
+      pk_val val1, val2;
+      uint64_t nfields;
+
+      if (!pk_decl_p (poke_compiler, type, PK_DECL_KIND_TYPE))
+        {
+          pk_printf (_("No such type `%s'\n"), type);
+          return 0;
+        }
+
+      val1 = diff_map_type (io1, type);
+      if (val1 == PK_NULL)
+        return 0;
+      val2 = diff_map_type (io2, type);
+      if (val2 == PK_NULL)
+        return 0;
+
+      nfields = pk_uint_value (pk_struct_nfields (val1));
+      for (i = 0; i < nfields; ++i)
+        {
+          pk_val fname = pk_struct_field_name (val1, i);
+          pk_val fval1 = pk_struct_field_value (val1, i);
+          pk_val fval2;
+
+          if (fname == PK_NULL)
+            continue;
+
+          fval2 = diff_struct_field (val2, pk_string_str (fname));
+          if (fval2 != PK_NULL && pk_val_equal_p (fval1, fval2))
+            continue;
+
+          pk_printf ("  %s: ", pk_string_str (fname));
+          pk_print_val (poke_compiler, fval1);
+          pk_puts (" -> ");
+          if (fval2 == PK_NULL)
+            pk_puts (_("(none)"));
+          else
+            pk_print_val (poke_compiler, fval2);
+          pk_puts ("\n");
+        }
+
+      return 1;
+    }
+
+  /* Compare the whole IO spaces.  */
+  size = pk_ios_size (io1);
+  if (pk_ios_size (io2) > size)
+    size = pk_ios_size (io2);
+
+  if (asprintf (&exp, "iodiff (%d, 0#b, %d, 0#b, %" PRIu64 "UL#b)",
+                pk_ios_get_id (io1), pk_ios_get_id (io2), size) == -1)
+    return 0;
+  ret = pk_compile_expression (poke_compiler, exp, NULL, &extents);
+  free (exp);
+  if (!ret)
+    return 0;
+
+  pk_puts (_("  Offset\t\tSize\n"));
+  nelem = pk_uint_value (pk_array_nelem (extents));
+  for (i = 0; i < nelem; ++i)
+    {
+      pk_val extent = pk_array_elem_val (extents, i);
+      pk_val offset = pk_array_elem_val (extent, 0);
+      pk_val esize = pk_array_elem_val (extent, 1);
+
+      print_overlay_extent (NULL,
+                            pk_int_value (pk_offset_magnitude (offset)),
+                            pk_int_value (pk_offset_magnitude (esize)),
+                            NULL);
+    }
+
+  return 1;
+}
+
 static char *
 ios_completion_function (const char *x, int state)
 {
@@ -359,5 +640,42 @@ const struct pk_cmd close_cmd =
 const struct pk_cmd info_ios_cmd =
   {"ios", "", "", 0, NULL, pk_cmd_info_ios, "info ios", NULL};
 
+const struct pk_cmd diff_cmd =
+  {"diff", "t,t,?s", "", 0, NULL, pk_cmd_diff, "diff #ID1, #ID2 [,TYPE]",
+   ios_completion_function};
+
 const struct pk_cmd load_cmd =
   {"load", "f", "", 0, NULL, pk_cmd_load_file, "load FILE-NAME", rl_filename_completion_function};
+
+extern struct pk_cmd null_cmd; /* pk-cmd.c  */
+
+const struct pk_cmd overlay_open_cmd =
+  {"open", "t", "", 0, NULL, pk_cmd_overlay_open, "overlay open #ID",
+   ios_completion_function};
+
+const struct pk_cmd overlay_commit_cmd =
+  {"commit", "?t", "", PK_CMD_F_REQ_IO, NULL, pk_cmd_overlay_commit,
+   "overlay commit [#ID]", ios_completion_function};
+
+const struct pk_cmd overlay_discard_cmd =
+  {"discard", "?t", "", PK_CMD_F_REQ_IO, NULL, pk_cmd_overlay_discard,
+   "overlay discard [#ID]", ios_completion_function};
+
+const struct pk_cmd overlay_diff_cmd =
+  {"diff", "?t", "", PK_CMD_F_REQ_IO, NULL, pk_cmd_overlay_diff,
+   "overlay diff [#ID]", ios_completion_function};
+
+const struct pk_cmd *overlay_cmds[] =
+  {
+    &overlay_open_cmd,
+    &overlay_commit_cmd,
+    &overlay_discard_cmd,
+    &overlay_diff_cmd,
+    &null_cmd
+  };
+
+struct pk_trie *overlay_trie;
+
+const struct pk_cmd overlay_cmd =
+  {"overlay", "", "", 0, &overlay_trie, NULL,
+   "overlay (open|commit|discard|diff)", NULL};
@@ -0,0 +1,91 @@
+/* pk-cmd-scan.c - Command to scan IO spaces for data of a given type.  */
+
+/* Copyright (C) 2020 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "poke.h"
+#include "pk-cmd.h"
+
+/* The scan is performed by pk_scan, defined in pk-scan.pk, which gets
+   the signature of the type and a function that maps values of the
+   type.  The signature is used to search for candidate offsets
+   natively, so the Poke mapper only runs where it has a chance to
+   succeed.  */
+
+#define PK_SCAN_FMT                                                     \
+  "{\n"                                                                 \
+  "  defun pk_scan_mapper = (int<32> ios, off64 o) uoff64:\n"           \
+  "  {\n"                                                               \
+  "    return (%s @ ios : o)'size;\n"                                   \
+  "  }\n"                                                               \
+  "  pk_scan (%d, \"%s\", pk_scan_mapper);\n"                           \
+  "}"
+
+static int
+pk_cmd_scan (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* scan TYPE [,#IOS] */
+
+  int ios_id;
+  const char *type;
+  char *signature, *cmd;
+  int ret;
+
+  assert (argc == 2);
+  assert (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_STR);
+  type = PK_CMD_ARG_STR (argv[0]);
+
+  if (PK_CMD_ARG_TYPE (argv[1]) == PK_CMD_ARG_NULL)
+    ios_id = pk_ios_get_id (pk_ios_cur (poke_compiler));
+  else
+    {
+      ios_id = PK_CMD_ARG_TAG (argv[1]);
+      if (pk_ios_search_by_id (poke_compiler, ios_id) == NULL)
+        {
+          pk_printf (_("No such IOS #%d\n"), ios_id);
+          return 0;
+        }
+    }
+
+  signature = pk_type_signature (poke_compiler, type);
+  if (signature == NULL)
+    {
+      pk_printf (_("No such struct type `%s'\n"), type);
+      return 0;
+    }
+
+  if (asprintf (&cmd, PK_SCAN_FMT, type, ios_id, signature) == -1)
+    {
+      free (signature);
+      return 0;
+    }
+
+  ret = pk_compile_buffer (poke_compiler, cmd, NULL /* end */);
+  free (cmd);
+  free (signature);
+
+  return ret;
+}
+
+const struct pk_cmd scan_cmd =
+  {"scan", "s,?t", "", PK_CMD_F_REQ_IO, NULL, pk_cmd_scan,
+   "scan TYPE [,#IOS]", NULL};
@@ -21,6 +21,7 @@
 #include <string.h>
 #include <arpa/inet.h> /* For htonl */
 #include <stdlib.h>
+#include <inttypes.h>
 #include "xalloc.h"
 
 #include "poke.h"
@@ -303,6 +304,53 @@ pk_cmd_set_pretty_print (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   return 1;
 }
 
+static int
+pk_cmd_set_lazy_map (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* set lazy-map {yes,no}  */
+
+  const char *arg;
+
+  /* Note that it is not possible to distinguish between no argument
+     and an empty unique string argument.  Therefore, argc should be
+     always 1 here, and we determine when no value was specified by
+     checking whether the passed string is empty or not.  */
+
+  if (argc != 1)
+    assert (0);
+
+  arg = PK_CMD_ARG_STR (argv[0]);
+
+  if (*arg == '\0')
+    {
+      if (pk_lazy_map (poke_compiler))
+        pk_puts ("yes\n");
+      else
+        pk_puts ("no\n");
+    }
+  else
+    {
+      int do_lazy_map;
+
+      if (STREQ (arg, "yes"))
+        do_lazy_map = 1;
+      else if (STREQ (arg, "no"))
+        do_lazy_map = 0;
+      else
+        {
+          pk_term_class ("error");
+          pk_puts ("error: ");
+          pk_term_end_class ("error");
+          pk_puts (" lazy-map should be one of `yes' or `no'.\n");
+          return 0;
+        }
+
+      pk_set_lazy_map (poke_compiler, do_lazy_map);
+    }
+
+  return 1;
+}
+
 static int
 pk_cmd_set_oacutoff (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
 {
@@ -557,6 +605,35 @@ pk_cmd_set_doc_viewer (int argc, struct pk_cmd_arg argv[],
   return 1;
 }
 
+static int
+pk_cmd_set_ios_cache_size (int argc, struct pk_cmd_arg argv[],
+                           uint64_t uflags)
+{
+  /* set ios-cache-size [SIZE]  */
+
+  assert (argc == 1);
+
+  if (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_NULL)
+    pk_printf ("%" PRIu64 "\n", pk_ios_cache_size (poke_compiler));
+  else
+    {
+      int64_t size = PK_CMD_ARG_INT (argv[0]);
+
+      if (size < 0)
+        {
+          pk_term_class ("error");
+          pk_puts ("error: ");
+          pk_term_end_class ("error");
+          pk_puts (_(" ios-cache-size should be a positive number or 0.\n"));
+          return 0;
+        }
+
+      pk_set_ios_cache_size (poke_compiler, size);
+    }
+
+  return 1;
+}
+
 extern struct pk_cmd null_cmd; /* pk-cmd.c  */
 
 const struct pk_cmd set_oacutoff_cmd =
@@ -587,6 +664,10 @@ const struct pk_cmd set_pretty_print_cmd =
   {"pretty-print", "s?", "", 0, NULL, pk_cmd_set_pretty_print,
    "set pretty-print (yes|no)", NULL};
 
+const struct pk_cmd set_lazy_map_cmd =
+  {"lazy-map", "s?", "", 0, NULL, pk_cmd_set_lazy_map,
+   "set lazy-map (yes|no)", NULL};
+
 const struct pk_cmd set_error_on_warning_cmd =
   {"error-on-warning", "s?", "", 0, NULL, pk_cmd_set_error_on_warning,
    "set error-on-warning (yes|no)", NULL};
@@ -603,6 +684,10 @@ const struct pk_cmd set_prompt_maps =
   {"prompt-maps", "s?", "", 0, NULL, pk_cmd_set_prompt_maps,
    "set prompt-maps (yes|no)", NULL};
 
+const struct pk_cmd set_ios_cache_size =
+  {"ios-cache-size", "?i", "", 0, NULL, pk_cmd_set_ios_cache_size,
+   "set ios-cache-size [SIZE]", NULL};
+
 const struct pk_cmd *set_cmds[] =
   {
    &set_oacutoff_cmd,
@@ -614,10 +699,12 @@ const struct pk_cmd *set_cmds[] =
    &set_endian_cmd,
    &set_nenc_cmd,
    &set_pretty_print_cmd,
+   &set_lazy_map_cmd,
    &set_error_on_warning_cmd,
    &set_doc_viewer,
    &set_auto_map,
    &set_prompt_maps,
+   &set_ios_cache_size,
    &null_cmd
   };
 
@@ -43,6 +43,8 @@ extern const struct pk_cmd mem_cmd; /* pk-cmd-ios.c */
 #ifdef HAVE_LIBNBD
 extern const struct pk_cmd nbd_cmd; /* pk-cmd-ios.c */
 #endif
+extern const struct pk_cmd overlay_cmd; /* pk-cmd-ios.c */
+extern const struct pk_cmd diff_cmd; /* pk-cmd-ios.c */
 extern const struct pk_cmd close_cmd; /* pk-cmd-file.c */
 extern const struct pk_cmd load_cmd; /* pk-cmd-file.c */
 extern const struct pk_cmd info_cmd; /* pk-cmd-info.c  */
@@ -55,6 +57,7 @@ extern const struct pk_cmd vm_cmd; /* pk-cmd-vm.c  */
 extern const struct pk_cmd set_cmd; /* pk-cmd-set.c */
 extern const struct pk_cmd editor_cmd; /* pk-cmd-editor.c */
 extern const struct pk_cmd map_cmd; /* pk-cmd-map.c */
+extern const struct pk_cmd scan_cmd; /* pk-cmd-scan.c */
 
 const struct pk_cmd null_cmd = {};
 
@@ -78,6 +81,9 @@ static const struct pk_cmd *dot_cmds[] =
 #ifdef HAVE_LIBNBD
     &nbd_cmd,
 #endif
+    &overlay_cmd,
+    &diff_cmd,
+    &scan_cmd,
     &null_cmd
   };
 
@@ -561,6 +567,9 @@ extern struct pk_trie *map_trie; /* pk-cmd-map.c */
 extern const struct pk_cmd *map_entry_cmds[]; /* pk-cmd-map.c  */
 extern struct pk_trie *map_entry_trie; /* pk-cmd-map.c  */
 
+extern const struct pk_cmd *overlay_cmds[]; /* pk-cmd-ios.c */
+extern struct pk_trie *overlay_trie; /* pk-cmd-ios.c */
+
 static struct pk_trie *cmds_trie;
 
 #define IS_COMMAND(input, cmd) \
@@ -721,6 +730,7 @@ pk_cmd_init (void)
   set_trie = pk_trie_from_cmds (set_cmds);
   map_trie = pk_trie_from_cmds (map_cmds);
   map_entry_trie = pk_trie_from_cmds (map_entry_cmds);
+  overlay_trie = pk_trie_from_cmds (overlay_cmds);
 
   /* Compile commands written in Poke.  */
   if (!pk_load (poke_compiler, "pk-cmd"))
@@ -738,6 +748,7 @@ pk_cmd_shutdown (void)
   pk_trie_free (set_trie);
   pk_trie_free (map_trie);
   pk_trie_free (map_entry_trie);
+  pk_trie_free (overlay_trie);
 }
 
 
@@ -0,0 +1,170 @@
+/* api-ios.c - Tests for the IO spaces API of libpoke.  */
+
+/* Copyright (C) 2020 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <dejagnu.h>
+
+#include "libpoke.h"
+
+/* The output of the compiler is not checked by these tests.  */
+
+static void
+test_flush (void)
+{
+}
+
+static void
+test_puts (const char *str)
+{
+}
+
+static void
+test_printf (const char *format, ...)
+{
+}
+
+static void
+test_indent (unsigned int lvl, unsigned int step)
+{
+}
+
+static void
+test_class (const char *class)
+{
+}
+
+static void
+test_end_class (const char *class)
+{
+}
+
+static void
+test_hyperlink (const char *url, const char *id)
+{
+}
+
+static void
+test_end_hyperlink (void)
+{
+}
+
+static struct pk_term_if test_term_if =
+  {
+    .flush_fn = test_flush,
+    .puts_fn = test_puts,
+    .printf_fn = test_printf,
+    .indent_fn = test_indent,
+    .class_fn = test_class,
+    .end_class_fn = test_end_class,
+    .hyperlink_fn = test_hyperlink,
+    .end_hyperlink_fn = test_end_hyperlink,
+  };
+
+/* Check that the bytes written with pk_ios_write at OFFSET are read
+   back by pk_ios_read.  */
+
+static void
+test_ios_write_read (pk_compiler pkc, pk_ios ios, uint64_t offset)
+{
+  const unsigned char out[] = { 0x10, 0x20, 0x30, 0x40, 0x50 };
+  unsigned char in[sizeof (out)];
+
+  if (pk_ios_write (pkc, ios, offset, sizeof (out), out) != PK_IOS_OK)
+    {
+      fail ("pk_ios_write at bit %lu", (unsigned long) offset);
+      return;
+    }
+
+  memset (in, 0, sizeof (in));
+  if (pk_ios_read (pkc, ios, offset, sizeof (in), in) != PK_IOS_OK)
+    {
+      fail ("pk_ios_read at bit %lu", (unsigned long) offset);
+      return;
+    }
+
+  if (memcmp (in, out, sizeof (out)) == 0)
+    pass ("pk_ios_write and pk_ios_read at bit %lu", (unsigned long) offset);
+  else
+    fail ("pk_ios_write and pk_ios_read at bit %lu", (unsigned long) offset);
+}
+
+/* Check that reading the COUNT bytes at OFFSET reports the end of
+   the IO space.  */
+
+static void
+test_ios_read_eof (pk_compiler pkc, pk_ios ios, uint64_t offset,
+                   size_t count)
+{
+  unsigned char *buf = malloc (count);
+
+  if (buf == NULL)
+    {
+      fail ("pk_ios_read EOF: out of memory");
+      return;
+    }
+
+  if (pk_ios_read (pkc, ios, offset, count, buf) == PK_IOS_EOF)
+    pass ("pk_ios_read EOF at bit %lu", (unsigned long) offset);
+  else
+    fail ("pk_ios_read EOF at bit %lu", (unsigned long) offset);
+
+  free (buf);
+}
+
+int
+main (int argc, char *argv[])
+{
+  pk_compiler pkc;
+  pk_ios ios;
+  uint64_t size;
+
+  pkc = pk_compiler_new (getenv ("POKEDATADIR"), &test_term_if);
+  if (pkc == NULL)
+    {
+      fail ("pk_compiler_new");
+      return 1;
+    }
+
+  if (pk_ios_open (pkc, "*api-ios*", 0, 1) == PK_IOS_ERROR)
+    {
+      fail ("pk_ios_open");
+      pk_compiler_free (pkc);
+      return 1;
+    }
+
+  ios = pk_ios_search (pkc, "*api-ios*");
+  size = pk_ios_size (ios);
+
+  test_ios_write_read (pkc, ios, 0);
+  test_ios_write_read (pkc, ios, 3);
+  test_ios_write_read (pkc, ios, size - 5 * 8);
+  test_ios_read_eof (pkc, ios, size, 1);
+  test_ios_read_eof (pkc, ios, size - 8, 2);
+  test_ios_read_eof (pkc, ios, 4, size / 8);
+
+  pk_ios_close (pkc, ios);
+  pk_compiler_free (pkc);
+
+  totals ();
+  return 0;
+}
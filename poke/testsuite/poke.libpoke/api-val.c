@@ -0,0 +1,177 @@
+/* api-val.c - Tests for the integer values API of libpoke.  */
+
+/* Copyright (C) 2020 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <dejagnu.h>
+
+#include "libpoke.h"
+
+/* The output of the compiler is not checked by these tests.  */
+
+static void
+test_flush (void)
+{
+}
+
+static void
+test_puts (const char *str)
+{
+}
+
+static void
+test_printf (const char *format, ...)
+{
+}
+
+static void
+test_indent (unsigned int lvl, unsigned int step)
+{
+}
+
+static void
+test_class (const char *class)
+{
+}
+
+static void
+test_end_class (const char *class)
+{
+}
+
+static void
+test_hyperlink (const char *url, const char *id)
+{
+}
+
+static void
+test_end_hyperlink (void)
+{
+}
+
+static struct pk_term_if test_term_if =
+  {
+    .flush_fn = test_flush,
+    .puts_fn = test_puts,
+    .printf_fn = test_printf,
+    .indent_fn = test_indent,
+    .class_fn = test_class,
+    .end_class_fn = test_end_class,
+    .hyperlink_fn = test_hyperlink,
+    .end_hyperlink_fn = test_end_hyperlink,
+  };
+
+/* Check that the signed integer VALUE survives a round trip through
+   pk_make_int and pk_int_value.  */
+
+static void
+test_int_value (int64_t value)
+{
+  pk_val val = pk_make_int (value, 64);
+
+  if (val != PK_NULL && pk_int_value (val) == value
+      && pk_int_size (val) == 64)
+    pass ("pk_int_value %" PRIi64, value);
+  else
+    fail ("pk_int_value %" PRIi64, value);
+}
+
+/* Likewise for the unsigned integer VALUE, pk_make_uint and
+   pk_uint_value.  */
+
+static void
+test_uint_value (uint64_t value)
+{
+  pk_val val = pk_make_uint (value, 64);
+
+  if (val != PK_NULL && pk_uint_value (val) == value
+      && pk_uint_size (val) == 64)
+    pass ("pk_uint_value %" PRIu64, value);
+  else
+    fail ("pk_uint_value %" PRIu64, value);
+}
+
+/* Check that the expression EXP evaluates to the signed integer
+   VALUE.  */
+
+static void
+test_int_exp (pk_compiler pkc, const char *exp, int64_t value)
+{
+  pk_val val;
+
+  if (pk_compile_expression (pkc, exp, NULL, &val)
+      && pk_int_value (val) == value)
+    pass ("%s", exp);
+  else
+    fail ("%s", exp);
+}
+
+int
+main (int argc, char *argv[])
+{
+  pk_compiler pkc;
+  int64_t max = ((int64_t) 1 << 53) - 1;
+  int64_t min = -((int64_t) 1 << 53);
+
+  pkc = pk_compiler_new (getenv ("POKEDATADIR"), &test_term_if);
+  if (pkc == NULL)
+    {
+      fail ("pk_compiler_new");
+      return 1;
+    }
+
+  /* Values that are stored unboxed, and their boxed neighbours.  */
+  test_int_value (max);
+  test_int_value (min);
+  test_int_value (max + 1);
+  test_int_value (min - 1);
+  test_int_value (-max - 1);
+  test_int_value (INT64_MAX);
+  test_int_value (INT64_MIN);
+  test_uint_value (max);
+  test_uint_value ((uint64_t) max + 1);
+  test_uint_value (UINT64_MAX);
+
+  /* Arithmetic crossing the boundary between both encodings.  Note
+     that the operands are variables, so the operations are not
+     constant folded by the compiler.  */
+  if (!pk_compile_buffer (pkc,
+                          "defvar max = 9007199254740991L;"
+                          "defvar min = -9007199254740992L;", NULL))
+    {
+      fail ("pk_compile_buffer");
+      pk_compiler_free (pkc);
+      return 1;
+    }
+
+  test_int_exp (pkc, "max + 1", max + 1);
+  test_int_exp (pkc, "max + 1 - 1", max);
+  test_int_exp (pkc, "min - 1", min - 1);
+  test_int_exp (pkc, "min - 1 + 1", min);
+  test_int_exp (pkc, "-min", max + 1);
+
+  pk_compiler_free (pkc);
+
+  totals ();
+  return 0;
+}